@@ -0,0 +1,108 @@
+#ifndef AAP_COMMAND
+#define AAP_COMMAND
+/*******************************************************************************
+ * Copyright (c) 2009 David Findlay
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *    - Redistributions of source code must retain the above copyright notice,
+ *      this list of conditions and the following disclaimer.
+ *    - Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ ******************************************************************************/
+
+#if defined(ARDUINO) && ARDUINO >= 100
+#include "Arduino.h"
+#else
+#include "WProgram.h"
+#endif
+
+/*
+ * How each type of command parameter goes on the wire: bytes as they are,
+ * and numbers as 4 bytes, big-endian. Only the types listed here can be
+ * sent, so passing anything else (an int, or one of the remotes' enums
+ * without a cast to byte) fails to compile rather than quietly picking a
+ * width.
+ */
+template <typename T>
+struct AAPParameter;
+
+template <>
+struct AAPParameter<byte>
+{
+    static const size_t SIZE = 1;
+
+    static void write(byte *p, byte b)
+    {
+        p[0] = b;
+    }
+};
+
+template <>
+struct AAPParameter<unsigned long>
+{
+    static const size_t SIZE = 4;
+
+    static void write(byte *p, unsigned long n)
+    {
+        p[0] = (n & 0xFF000000) >> 24;
+        p[1] = (n & 0x00FF0000) >> 16;
+        p[2] = (n & 0x0000FF00) >> 8;
+        p[3] = (n & 0x000000FF) >> 0;
+    }
+};
+
+template <>
+struct AAPParameter<long> : public AAPParameter<unsigned long>
+{
+};
+
+/*
+ * The number of bytes a list of parameters takes up, worked out when
+ * the sketch is compiled.
+ */
+template <typename... Params>
+struct AAPParametersSize;
+
+template <>
+struct AAPParametersSize<>
+{
+    static const size_t SIZE = 0;
+};
+
+template <typename First, typename... Rest>
+struct AAPParametersSize<First, Rest...>
+{
+    static const size_t SIZE = AAPParameter<First>::SIZE + AAPParametersSize<Rest...>::SIZE;
+};
+
+/*
+ * Writes the parameters one after another starting at p.
+ */
+inline void writeAAPParameters(byte *p)
+{
+    (void) p;
+}
+
+template <typename First, typename... Rest>
+inline void writeAAPParameters(byte *p, First first, Rest... rest)
+{
+    AAPParameter<First>::write(p, first);
+    writeAAPParameters(p + AAPParameter<First>::SIZE, rest...);
+}
+
+#endif // AAP_COMMAND
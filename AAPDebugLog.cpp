@@ -0,0 +1,177 @@
+/*******************************************************************************
+ * Copyright (c) 2009 David Findlay
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *    - Redistributions of source code must retain the above copyright notice,
+ *      this list of conditions and the following disclaimer.
+ *    - Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ ******************************************************************************/
+#include "AAPDebugLog.h"
+
+AAPDebugLog::AAPDebugLog(byte *pBuffer, size_t size)
+    : pBuffer(pBuffer),
+      size(size),
+      head(0),
+      count(0),
+      dropped(0)
+{
+}
+
+void AAPDebugLog::add(Destination destination, const char *pMessage)
+{
+    start(destination, FORMAT_PLAIN, pMessage, 0);
+}
+
+void AAPDebugLog::addNumber(Destination destination, const char *pMessage, unsigned long number)
+{
+    if (start(destination, FORMAT_NUMBER, pMessage, sizeof(number)))
+    {
+        push((const byte *) &number, sizeof(number));
+    }
+}
+
+void AAPDebugLog::addBytes(Destination destination, const char *pMessage, const byte *pData, size_t length)
+{
+    // the length has to fit in a byte
+    const byte kept = (length > 0xFF) ? 0xFF : length;
+    if (start(destination, FORMAT_BYTES, pMessage, 1 + kept))
+    {
+        push(&kept, 1);
+        push(pData, kept);
+    }
+}
+
+bool AAPDebugLog::start(Destination destination, Format format, const char *pMessage, size_t payloadSize)
+{
+    if (size - count < HEADER_SIZE + payloadSize)
+    {
+        if (dropped < 0xFFFF)
+        {
+            ++dropped;
+        }
+        return false;
+    }
+
+    const byte flags = format | ((destination == TO_LOG) ? DESTINATION_LOG : 0);
+    push(&flags, 1);
+    push((const byte *) &pMessage, sizeof(pMessage));
+    return true;
+}
+
+bool AAPDebugLog::isEmpty() const
+{
+    return (count == 0) && (dropped == 0);
+}
+
+void AAPDebugLog::printOne(Print *pDebugPrint, Print *pLogPrint)
+{
+    if (count == 0)
+    {
+        if (dropped && pDebugPrint)
+        {
+            pDebugPrint->print(dropped);
+            printFlash(*pDebugPrint, PSTR(" debug messages dropped"));
+            pDebugPrint->println();
+        }
+        dropped = 0;
+        return;
+    }
+
+    byte flags;
+    const char *pMessage;
+    pop(&flags, 1);
+    pop((byte *) &pMessage, sizeof(pMessage));
+
+    Print *pOut = (flags & DESTINATION_LOG) ? pLogPrint : pDebugPrint;
+    if (pOut)
+    {
+        printFlash(*pOut, pMessage);
+    }
+
+    switch (flags & ~DESTINATION_LOG)
+    {
+    case FORMAT_NUMBER:
+    {
+        unsigned long number;
+        pop((byte *) &number, sizeof(number));
+        if (pOut)
+        {
+            pOut->print(number, DEC);
+        }
+        break;
+    }
+
+    case FORMAT_BYTES:
+    {
+        byte length;
+        pop(&length, 1);
+        for (byte i = 0; i < length; ++i)
+        {
+            byte b;
+            pop(&b, 1);
+            if (pOut)
+            {
+                pOut->print(' ');
+                pOut->print(b, HEX);
+            }
+        }
+        break;
+    }
+    }
+
+    if (pOut)
+    {
+        pOut->println();
+    }
+}
+
+void AAPDebugLog::printFlash(Print &out, const char *pString)
+{
+    for (char c; (c = pgm_read_byte(pString)) != 0; ++pString)
+    {
+        out.print(c);
+    }
+}
+
+void AAPDebugLog::push(const byte *pData, size_t length)
+{
+    for (size_t i = 0; i < length; ++i)
+    {
+        size_t tail = head + count;
+        if (tail >= size)
+        {
+            tail -= size;
+        }
+        pBuffer[tail] = pData[i];
+        ++count;
+    }
+}
+
+void AAPDebugLog::pop(byte *pData, size_t length)
+{
+    for (size_t i = 0; i < length; ++i)
+    {
+        pData[i] = pBuffer[head];
+        if (++head == size)
+        {
+            head = 0;
+        }
+        --count;
+    }
+}
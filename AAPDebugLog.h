@@ -0,0 +1,109 @@
+#ifndef AAP_DEBUG_LOG
+#define AAP_DEBUG_LOG
+/*******************************************************************************
+ * Copyright (c) 2009 David Findlay
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *    - Redistributions of source code must retain the above copyright notice,
+ *      this list of conditions and the following disclaimer.
+ *    - Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ ******************************************************************************/
+
+#if defined(ARDUINO) && ARDUINO >= 100
+#include "Arduino.h"
+#else
+#include "WProgram.h"
+#endif
+
+#if defined(__AVR__)
+#include <avr/pgmspace.h>
+#endif
+
+/**
+ * A ring buffer of debug messages waiting to be printed. Printing a line
+ * to a serial port at 9600 or even 115200 baud takes far longer than
+ * handling a byte from the iPod, so rather than print as things happen
+ * we note down which message it was (a pointer to a PSTR() string, which
+ * stays in flash) and any number or bytes that go with it, and print them
+ * later when there's nothing better to do. Messages that don't fit are
+ * dropped, and counted.
+ *
+ * Each message goes to one of two Prints: the debug one, for what the
+ * library is doing, or the log one, for the commands the sketch asked for.
+ */
+class AAPDebugLog
+{
+public: // enums
+    enum Destination
+    {
+        TO_DEBUG = 0,
+        TO_LOG
+    };
+
+public: // methods
+    AAPDebugLog(byte *pBuffer, size_t size);
+
+    /**
+     * Queues a message, optionally followed by a number (printed in
+     * decimal) or some bytes (printed in hex). pMessage must be a PSTR().
+     */
+    void add(Destination destination, const char *pMessage);
+    void addNumber(Destination destination, const char *pMessage, unsigned long number);
+    void addBytes(Destination destination, const char *pMessage, const byte *pData, size_t length);
+
+    bool isEmpty() const;
+
+    /**
+     * Prints the oldest message to whichever Print it's meant for, or
+     * throws it away if that's 0.
+     */
+    void printOne(Print *pDebugPrint, Print *pLogPrint);
+
+    /**
+     * Prints a string that's in flash.
+     */
+    static void printFlash(Print &out, const char *pString);
+
+private: // enums
+    enum Format
+    {
+        FORMAT_PLAIN = 0,
+        FORMAT_NUMBER,
+        FORMAT_BYTES
+    };
+
+private: // attributes
+    // what's at the start of every record: destination and format
+    // flags, then the message pointer
+    static const size_t HEADER_SIZE = 1 + sizeof(const char *);
+    static const byte DESTINATION_LOG = 0x80;
+
+    byte *pBuffer;
+    size_t size;
+    size_t head;
+    size_t count;
+    unsigned int dropped;
+
+private: // methods
+    bool start(Destination destination, Format format, const char *pMessage, size_t payloadSize);
+    void push(const byte *pData, size_t length);
+    void pop(byte *pData, size_t length);
+};
+
+#endif // AAP_DEBUG_LOG
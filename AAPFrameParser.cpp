@@ -0,0 +1,499 @@
+/*******************************************************************************
+ * Copyright (c) 2009 David Findlay
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *    - Redistributions of source code must retain the above copyright notice,
+ *      this list of conditions and the following disclaimer.
+ *    - Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ ******************************************************************************/
+#include "AAPFrameParser.h"
+
+AAPFrameParser::AAPFrameParser(byte *pBuffer, size_t bufferSize)
+    : pBuffer(pBuffer),
+      bufferSize(bufferSize),
+      receiveState(WAITING_FOR_HEADER1),
+      dataSize(0),
+      largePacket(false),
+      received(0),
+      checksum(0),
+      event(EVENT_NONE),
+      overLength(false),
+      streaming(false),
+      headerEvents(false),
+      skipping(false),
+      truncating(false),
+      keepFrom(0),
+      chunkStart(0),
+      chunkFill(0),
+      replayPos(0),
+      replayEnd(0),
+      resyncing(false),
+      resyncCount(0),
+      bytesSinceFrame(0),
+      lastResyncBytesLost(0)
+#if IPOD_SERIAL_STATS
+    ,
+      overLengthCount(0),
+      skippedCount(0),
+      checksumFailureCount(0),
+      discardedByteCount(0)
+#endif
+{
+}
+
+size_t AAPFrameParser::feed(const byte *pBytes, size_t length)
+{
+    event = EVENT_NONE;
+
+    size_t used = 0;
+    for (;;)
+    {
+        // finish rescanning whatever was left over from a bad frame before
+        // we look at anything new, including a bad frame found part way
+        // through these bytes
+        while (replayPos < replayEnd)
+        {
+            event = step(pBuffer[replayPos++]);
+            if (event != EVENT_NONE)
+            {
+                return used;
+            }
+        }
+
+        if (used == length)
+        {
+            return used;
+        }
+
+        ++bytesSinceFrame;
+        event = step(pBytes[used++]);
+        if (event != EVENT_NONE)
+        {
+            return used;
+        }
+    }
+}
+
+AAPFrameParser::Event AAPFrameParser::step(byte b)
+{
+    switch (receiveState)
+    {
+    case WAITING_FOR_HEADER1:
+        if (b == HEADER1)
+        {
+            receiveState = WAITING_FOR_HEADER2;
+        }
+        else
+        {
+            startResync();
+        }
+        break;
+
+    case WAITING_FOR_HEADER2:
+        if (b == HEADER2)
+        {
+            receiveState = WAITING_FOR_LENGTH;
+        }
+        else
+        {
+            // the 0xFF we saw wasn't a header after all,
+            // but this byte might be the start of one
+            startResync();
+            receiveState = (b == HEADER1) ? WAITING_FOR_HEADER2 : WAITING_FOR_HEADER1;
+        }
+        break;
+
+    case WAITING_FOR_LENGTH:
+        checksum = b;
+        if (b == LARGE_PACKET_MARKER)
+        {
+            largePacket = true;
+            receiveState = WAITING_FOR_LENGTH_HIGH;
+        }
+        else
+        {
+            largePacket = false;
+            dataSize = b;
+            startData();
+        }
+        break;
+
+    case WAITING_FOR_LENGTH_HIGH:
+        checksum += b;
+        dataSize = ((size_t) b) << 8;
+        receiveState = WAITING_FOR_LENGTH_LOW;
+        break;
+
+    case WAITING_FOR_LENGTH_LOW:
+        checksum += b;
+        dataSize |= b;
+        if ((dataSize >= bufferSize) && !streaming)
+        {
+            // Skipping a single-byte-length frame we've no room for costs
+            // at most 255 bytes, but a bogus large-packet length could have
+            // us skip tens of thousands, so with nobody to stream it to we
+            // treat it as garbage and carry on hunting for a header from the
+            // length bytes onwards.
+            startResync();
+            receiveState = WAITING_FOR_HEADER1;
+            step((byte) (dataSize >> 8));
+            step(b);
+            break;
+        }
+        startData();
+        break;
+
+    case WAITING_FOR_DATA:
+        if (truncating)
+        {
+            // keep as much as fits, leaving room for the terminating NUL
+            if (received < bufferSize - 1)
+            {
+                pBuffer[received] = b;
+            }
+        }
+        else if (overLength)
+        {
+            if (streaming)
+            {
+                if (chunkFill == bufferSize)
+                {
+                    // the previous chunk has been handed over by now
+                    chunkStart += chunkFill;
+                    chunkFill = 0;
+                }
+                pBuffer[chunkFill++] = b;
+            }
+            else if (received < HEADER_EVENT_SIZE)
+            {
+                // for EVENT_FRAME_HEADER, in case it's wanted cut short
+                pBuffer[received] = b;
+            }
+        }
+        else if (!skipping)
+        {
+            pBuffer[received] = b;
+        }
+        else
+        {
+            // A skipped frame is kept from the first byte that could start
+            // a header, in case it turns out to be bad and has to be
+            // rescanned; nothing before that could start a frame.
+            if ((b == HEADER1) && (received < keepFrom))
+            {
+                keepFrom = received;
+            }
+            if (received >= keepFrom)
+            {
+                pBuffer[received] = b;
+            }
+        }
+        checksum += b;
+
+        if (++received == dataSize)
+        {
+            receiveState = WAITING_FOR_CHECKSUM;
+        }
+        else if (headerEvents && (received == HEADER_EVENT_SIZE))
+        {
+            return EVENT_FRAME_HEADER;
+        }
+        else if (overLength && streaming && !truncating && (chunkFill == bufferSize))
+        {
+            return EVENT_CHUNK;
+        }
+        break;
+
+    case WAITING_FOR_CHECKSUM:
+        // the checksum byte makes the sum of length, data and checksum zero
+        if ((byte) (checksum + b) != 0)
+        {
+#if IPOD_SERIAL_STATS
+            ++checksumFailureCount;
+#endif
+            startResync();
+            if (overLength)
+            {
+                // we didn't keep it, so there's nothing to rescan
+                receiveState = (b == HEADER1) ? WAITING_FOR_HEADER2 : WAITING_FOR_HEADER1;
+                if (streaming && !truncating)
+                {
+                    return EVENT_STREAM_FAILED;
+                }
+            }
+            else
+            {
+                rescan(b);
+            }
+            break;
+        }
+
+        receiveState = WAITING_FOR_HEADER1;
+        frameCompleted();
+
+        if (truncating)
+        {
+            // it's handed over as a frame of what was kept
+            dataSize = bufferSize - 1;
+        }
+        else if (overLength)
+        {
+            if (streaming)
+            {
+                return EVENT_LAST_CHUNK;
+            }
+#if IPOD_SERIAL_STATS
+            ++overLengthCount;
+#endif
+            break;
+        }
+
+        if (skipping)
+        {
+#if IPOD_SERIAL_STATS
+            ++skippedCount;
+#endif
+            return EVENT_FRAME_SKIPPED;
+        }
+
+        pBuffer[dataSize] = 0;
+        return EVENT_FRAME;
+    }
+
+    return EVENT_NONE;
+}
+
+void AAPFrameParser::startData()
+{
+    received = 0;
+    chunkStart = 0;
+    chunkFill = 0;
+    skipping = false;
+    truncating = false;
+
+    // no room for it (we need one spare byte for the terminating NUL),
+    // so we'll either stream it or just keep track of its checksum as it
+    // goes by
+    overLength = (dataSize >= bufferSize);
+
+    receiveState = dataSize ? WAITING_FOR_DATA : WAITING_FOR_CHECKSUM;
+}
+
+void AAPFrameParser::startResync()
+{
+    if (!resyncing)
+    {
+        resyncing = true;
+        ++resyncCount;
+    }
+}
+
+void AAPFrameParser::rescan(byte checksumByte)
+{
+    // The frame was bad, but a real header may be hiding inside it (e.g. if
+    // the previous frame was truncated), so rather than throw it all away we
+    // go back over everything after the header we locked on to. The data
+    // and checksum bytes get replayed at the start of the next feed(),
+    // followed by anything still waiting to be replayed from an earlier
+    // rescan.
+    //
+    // The data is always behind the replay position in the buffer, so
+    // compacting it like this never overwrites something we still need.
+    //
+    // A skipped frame was only kept from its first 0xFF on, but the bytes
+    // before that would just have been thrown away again.
+    const size_t start = skipping ? keepFrom : 0;
+    const size_t pending = replayEnd - replayPos;
+    pBuffer[dataSize] = checksumByte;
+    memmove(&pBuffer[dataSize + 1], &pBuffer[replayPos], pending);
+    replayPos = start;
+    replayEnd = dataSize + 1 + pending;
+    skipping = false;
+
+    // The length bytes can be rescanned right now, since three bytes
+    // aren't enough to get as far as storing data or finishing a frame.
+    receiveState = WAITING_FOR_HEADER1;
+    if (start > 0)
+    {
+        return;
+    }
+    if (largePacket)
+    {
+        step(LARGE_PACKET_MARKER);
+        step((byte) (dataSize >> 8));
+    }
+    step((byte) dataSize);
+}
+
+void AAPFrameParser::frameCompleted()
+{
+    // whatever is still to be replayed came in after this frame
+    const size_t pending = replayEnd - replayPos;
+    const size_t frameBytes = 2 + (largePacket ? 3 : 1) + dataSize + 1;
+
+    if (resyncing)
+    {
+        lastResyncBytesLost = bytesSinceFrame - frameBytes - pending;
+#if IPOD_SERIAL_STATS
+        discardedByteCount += lastResyncBytesLost;
+#endif
+        resyncing = false;
+    }
+    bytesSinceFrame = pending;
+}
+
+bool AAPFrameParser::frameReady() const
+{
+    return event == EVENT_FRAME;
+}
+
+AAPFrameParser::Event AAPFrameParser::getEvent() const
+{
+    return event;
+}
+
+const byte *AAPFrameParser::frameData() const
+{
+    return pBuffer;
+}
+
+size_t AAPFrameParser::frameLength() const
+{
+    return dataSize;
+}
+
+size_t AAPFrameParser::chunkOffset() const
+{
+    return overLength ? chunkStart : 0;
+}
+
+size_t AAPFrameParser::chunkLength() const
+{
+    return overLength ? chunkFill : dataSize;
+}
+
+void AAPFrameParser::setStreaming(bool enable)
+{
+    streaming = enable;
+}
+
+void AAPFrameParser::setHeaderEvents(bool enable)
+{
+    headerEvents = enable;
+}
+
+void AAPFrameParser::skipFrame()
+{
+    if ((receiveState == WAITING_FOR_DATA) && !overLength)
+    {
+        skipping = true;
+
+        // keep everything if a header could already have started
+        // (see rescan()), otherwise nothing until one might
+        keepFrom = dataSize;
+        if (((byte) dataSize == HEADER1) || (largePacket && ((byte) (dataSize >> 8) == HEADER1)))
+        {
+            keepFrom = 0;
+        }
+        for (size_t i = 0; i < received; ++i)
+        {
+            if (pBuffer[i] == HEADER1)
+            {
+                keepFrom = 0;
+            }
+        }
+    }
+}
+
+void AAPFrameParser::truncateFrame()
+{
+    if ((receiveState == WAITING_FOR_DATA) && overLength && (received == HEADER_EVENT_SIZE))
+    {
+        truncating = true;
+    }
+}
+
+bool AAPFrameParser::frameTruncated() const
+{
+    return truncating && (event == EVENT_FRAME);
+}
+
+AAPFrameParser::ReceiveState AAPFrameParser::getState() const
+{
+    return receiveState;
+}
+
+bool AAPFrameParser::isResyncing() const
+{
+    return resyncing;
+}
+
+unsigned long AAPFrameParser::getResyncCount() const
+{
+    return resyncCount;
+}
+
+size_t AAPFrameParser::getLastResyncBytesLost() const
+{
+    return lastResyncBytesLost;
+}
+
+#if IPOD_SERIAL_STATS
+unsigned long AAPFrameParser::getOverLengthCount() const
+{
+    return overLengthCount;
+}
+
+unsigned long AAPFrameParser::getSkippedCount() const
+{
+    return skippedCount;
+}
+
+unsigned long AAPFrameParser::getChecksumFailureCount() const
+{
+    return checksumFailureCount;
+}
+
+unsigned long AAPFrameParser::getDiscardedByteCount() const
+{
+    return discardedByteCount;
+}
+#endif
+
+void AAPFrameParser::resetCounts()
+{
+    resyncCount = 0;
+#if IPOD_SERIAL_STATS
+    overLengthCount = 0;
+    skippedCount = 0;
+    checksumFailureCount = 0;
+    discardedByteCount = 0;
+#endif
+}
+
+void AAPFrameParser::reset()
+{
+    receiveState = WAITING_FOR_HEADER1;
+    event = EVENT_NONE;
+    skipping = false;
+    replayPos = 0;
+    replayEnd = 0;
+    resyncing = false;
+    bytesSinceFrame = 0;
+}
@@ -0,0 +1,275 @@
+#ifndef AAP_FRAME_PARSER
+#define AAP_FRAME_PARSER
+/*******************************************************************************
+ * Copyright (c) 2009 David Findlay
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *    - Redistributions of source code must retain the above copyright notice,
+ *      this list of conditions and the following disclaimer.
+ *    - Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ ******************************************************************************/
+
+#if defined(ARDUINO) && ARDUINO >= 100
+#include "Arduino.h"
+#else
+#include "WProgram.h"
+#endif
+
+// Whether the parser keeps the counts behind iPodSerial's link statistics
+// (see iPodSerial.h); the resync tracking is always there.
+#if !defined(IPOD_SERIAL_STATS)
+#define IPOD_SERIAL_STATS 1
+#endif
+
+/**
+ * Reassembles AAP frames (header, length, data, checksum) from a stream
+ * of bytes. It doesn't know where the bytes come from, so you can push
+ * them in one at a time from a serial port, or in bulk from a DMA buffer,
+ * a network connection or a log file.
+ *
+ * Typical use:
+ *
+ *     while (length > 0)
+ *     {
+ *         const size_t used = parser.feed(pBytes, length);
+ *         pBytes += used;
+ *         length -= used;
+ *         if (parser.frameReady())
+ *         {
+ *             handleFrame(parser.frameData(), parser.frameLength());
+ *         }
+ *     }
+ *
+ * The parser doesn't own any memory; the frame data (mode, command and
+ * parameters) is reassembled in the buffer given to the constructor and
+ * stays valid until the next call to feed(). The byte after the frame data
+ * is set to 0 so that string parameters are always NUL-terminated, which
+ * means the buffer needs to be one byte bigger than the longest frame.
+ * Frames too long for the buffer are skipped over (their checksum is still
+ * checked, so the parser stays in step with the sender) and counted by
+ * getOverLengthCount(), unless streaming is turned on with setStreaming().
+ * Large-packet frames too long for the buffer are only accepted when
+ * streaming; otherwise their length is assumed to be corrupt.
+ *
+ * Both forms of the length field are understood: a single byte for frames
+ * of up to 255 bytes, and the large-packet form (a 0x00 marker followed by
+ * a 2-byte big-endian length) for anything longer.
+ *
+ * When streaming, a frame too long for the buffer is handed over a
+ * buffer-full at a time as it arrives: feed() stops with EVENT_CHUNK for
+ * each piece, and EVENT_LAST_CHUNK for the final piece once the checksum
+ * has been checked. If the checksum turns out to be bad you get
+ * EVENT_STREAM_FAILED instead, and should throw away what you were given.
+ *
+ * With setHeaderEvents() on, feed() also stops with EVENT_FRAME_HEADER
+ * once the first HEADER_EVENT_SIZE bytes of a frame's data (the mode and
+ * command bytes) have arrived, if there's more to come. frameData() and
+ * frameLength() then give those bytes and the length the frame will be,
+ * and if it isn't wanted, skipFrame() has the rest of it go by without
+ * being kept. Its checksum is still checked, to keep in step with the
+ * sender, and a good one ends in EVENT_FRAME_SKIPPED rather than
+ * EVENT_FRAME. Its bytes are kept from the first 0xFF on, though, since
+ * a real frame could start there if the skipped one turns out to be bad,
+ * so a skipped frame is rescanned just like any other.
+ *
+ * Header events come for frames too long for the buffer as well, and
+ * truncateFrame() then has such a frame kept as far as it fits instead
+ * of skipped or streamed. If its checksum is good it ends in EVENT_FRAME,
+ * with frameLength() the length that was kept and frameTruncated() true.
+ */
+class AAPFrameParser
+{
+public: // enums
+    enum ReceiveState
+    {
+        WAITING_FOR_HEADER1 = 0,
+        WAITING_FOR_HEADER2,
+        WAITING_FOR_LENGTH,
+        WAITING_FOR_LENGTH_HIGH,
+        WAITING_FOR_LENGTH_LOW,
+        WAITING_FOR_DATA,
+        WAITING_FOR_CHECKSUM
+    };
+
+    enum Event
+    {
+        EVENT_NONE = 0,
+        EVENT_FRAME,
+        EVENT_CHUNK,
+        EVENT_LAST_CHUNK,
+        EVENT_STREAM_FAILED,
+        EVENT_FRAME_HEADER,
+        EVENT_FRAME_SKIPPED
+    };
+
+public: // attributes
+    static const byte HEADER1 = 0xFF;
+    static const byte HEADER2 = 0x55;
+    static const byte LARGE_PACKET_MARKER = 0x00;
+    static const size_t HEADER_EVENT_SIZE = 3;
+
+public: // methods
+    AAPFrameParser(byte *pBuffer, size_t bufferSize);
+
+    /**
+     * Pushes bytes into the parser. Consumes bytes until either a complete
+     * frame has been received or all the bytes have been used up, and
+     * returns how many bytes were consumed. Call frameReady() afterwards
+     * to see whether a frame is waiting; if so, call feed() again with the
+     * remaining bytes once you're done with it.
+     *
+     * Note that after a bad frame the parser rescans the bytes it already
+     * has, which can turn up frames without consuming any new bytes, so
+     * keep calling feed() while it returns 0 with a frame ready.
+     */
+    size_t feed(const byte *pBytes, size_t length);
+
+    /**
+     * Returns true if the last call to feed() completed a valid frame.
+     */
+    bool frameReady() const;
+
+    /**
+     * What, if anything, the last call to feed() stopped for.
+     */
+    Event getEvent() const;
+
+    /**
+     * The data of the completed frame (mode byte onwards, no header,
+     * length or checksum), or of the current chunk when streaming.
+     * frameLength() is always the length of the whole frame.
+     */
+    const byte *frameData() const;
+    size_t frameLength() const;
+
+    /**
+     * Where the current chunk starts within its frame's data, and how long it is.
+     */
+    size_t chunkOffset() const;
+    size_t chunkLength() const;
+
+    /**
+     * Turns streaming of frames that are too long for the buffer on or off.
+     * It's off by default.
+     */
+    void setStreaming(bool enable);
+
+    /**
+     * Turns EVENT_FRAME_HEADER on or off (see above); it's off by default.
+     * skipFrame() and truncateFrame() are only any use straight after one.
+     */
+    void setHeaderEvents(bool enable);
+    void skipFrame();
+    void truncateFrame();
+    bool frameTruncated() const;
+
+    ReceiveState getState() const;
+
+    /**
+     * Corruption tracking. The parser is resyncing from the moment it has
+     * to throw away a byte (noise between frames, a bad length or a failed
+     * checksum) until the next valid frame arrives. Each such episode
+     * counts once towards getResyncCount(), and getLastResyncBytesLost()
+     * says how many bytes the most recently finished one cost.
+     */
+    bool isResyncing() const;
+    unsigned long getResyncCount() const;
+    size_t getLastResyncBytesLost() const;
+
+#if IPOD_SERIAL_STATS
+    /**
+     * The number of otherwise-valid frames that were skipped because
+     * they were too long for the buffer.
+     */
+    unsigned long getOverLengthCount() const;
+
+    /**
+     * The number of good frames that went by without being kept because
+     * skipFrame() was called for them.
+     */
+    unsigned long getSkippedCount() const;
+
+    /**
+     * The number of candidate frames whose checksum didn't add up, and the
+     * total number of bytes thrown away while hunting for a good header.
+     * Bytes are only counted as thrown away once the next good frame has
+     * arrived, since until then some of them may yet turn out to be part
+     * of it.
+     */
+    unsigned long getChecksumFailureCount() const;
+    unsigned long getDiscardedByteCount() const;
+#endif
+
+    /**
+     * Zeroes all the counts above, and the resync count.
+     */
+    void resetCounts();
+
+    /**
+     * Throws away any partially-received frame and starts looking
+     * for a header again.
+     */
+    void reset();
+
+private: // attributes
+    byte *pBuffer;
+    size_t bufferSize;
+
+    ReceiveState receiveState;
+    size_t dataSize;
+    bool largePacket;
+    size_t received;
+    byte checksum;
+    Event event;
+    bool overLength;
+
+    bool streaming;
+    bool headerEvents;
+    bool skipping;
+    bool truncating;
+    // where a skipped frame's data starts being kept
+    size_t keepFrom;
+    size_t chunkStart;
+    size_t chunkFill;
+
+    // bytes from a bad frame still to be rescanned
+    size_t replayPos;
+    size_t replayEnd;
+
+    bool resyncing;
+    unsigned long resyncCount;
+    size_t bytesSinceFrame;
+    size_t lastResyncBytesLost;
+
+#if IPOD_SERIAL_STATS
+    unsigned long overLengthCount;
+    unsigned long skippedCount;
+    unsigned long checksumFailureCount;
+    unsigned long discardedByteCount;
+#endif
+
+private: // methods
+    Event step(byte b);
+    void startData();
+    void startResync();
+    void rescan(byte checksumByte);
+    void frameCompleted();
+};
+
+#endif // AAP_FRAME_PARSER
@@ -0,0 +1,131 @@
+/*******************************************************************************
+ * Copyright (c) 2009 David Findlay
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *    - Redistributions of source code must retain the above copyright notice,
+ *      this list of conditions and the following disclaimer.
+ *    - Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ ******************************************************************************/
+#include "AAPWireTrace.h"
+
+AAPWireTrace::AAPWireTrace()
+    : pBuffer(0),
+      capacity(0),
+      head(0),
+      count(0),
+      lastMicros(0)
+{
+}
+
+void AAPWireTrace::setBuffer(byte *pNewBuffer, size_t size)
+{
+    pBuffer = pNewBuffer;
+    capacity = pNewBuffer ? (size / RECORD_SIZE) : 0;
+    clear();
+}
+
+bool AAPWireTrace::isEnabled() const
+{
+    return capacity > 0;
+}
+
+void AAPWireTrace::record(RecordType type, const byte *pData, size_t length)
+{
+    if (capacity == 0)
+    {
+        return;
+    }
+
+    const unsigned long now = micros();
+    unsigned long delta = now - lastMicros;
+    lastMicros = now;
+
+    if (delta > 0xFFFF)
+    {
+        const unsigned long gapMillis = delta / 1000;
+        add(RECORD_GAP, 0, (gapMillis > 0xFFFF) ? 0xFFFF : gapMillis);
+        delta %= 1000;
+    }
+
+    // the rest of a write went out at the same moment as its first byte
+    for (size_t i = 0; i < length; ++i)
+    {
+        add(type, pData[i], i ? 0 : delta);
+    }
+}
+
+void AAPWireTrace::add(RecordType type, byte data, unsigned int delta)
+{
+    size_t slot = head + count;
+    if (slot >= capacity)
+    {
+        slot -= capacity;
+    }
+
+    if (count == capacity)
+    {
+        // full, so this one takes the place of the oldest
+        if (++head == capacity)
+        {
+            head = 0;
+        }
+    }
+    else
+    {
+        ++count;
+    }
+
+    byte *pRecord = &pBuffer[slot * RECORD_SIZE];
+    pRecord[0] = type;
+    pRecord[1] = data;
+    pRecord[2] = delta >> 8;
+    pRecord[3] = delta & 0xFF;
+}
+
+size_t AAPWireTrace::recordCount() const
+{
+    return count;
+}
+
+size_t AAPWireTrace::dump(Print &out) const
+{
+    const byte header[] =
+    {
+        'A', 'A', 'P', 'T',
+        FORMAT_VERSION,
+        (byte) (((unsigned long) count) >> 24),
+        (byte) (((unsigned long) count) >> 16),
+        (byte) (count >> 8),
+        (byte) count
+    };
+    size_t written = out.write(header, sizeof(header));
+
+    // the ring may wrap, in which case it goes out in two pieces
+    const size_t firstPart = (head + count > capacity) ? (capacity - head) : count;
+    written += out.write(&pBuffer[head * RECORD_SIZE], firstPart * RECORD_SIZE);
+    written += out.write(pBuffer, (count - firstPart) * RECORD_SIZE);
+    return written;
+}
+
+void AAPWireTrace::clear()
+{
+    head = 0;
+    count = 0;
+    lastMicros = micros();
+}
@@ -0,0 +1,112 @@
+#ifndef AAP_WIRE_TRACE
+#define AAP_WIRE_TRACE
+/*******************************************************************************
+ * Copyright (c) 2009 David Findlay
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *    - Redistributions of source code must retain the above copyright notice,
+ *      this list of conditions and the following disclaimer.
+ *    - Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ ******************************************************************************/
+
+#if defined(ARDUINO) && ARDUINO >= 100
+#include "Arduino.h"
+#else
+#include "WProgram.h"
+#endif
+
+/**
+ * A flight recorder for the serial link: a ring of timestamped records of
+ * the bytes sent to and received from the iPod, kept in a buffer you give
+ * it. Once the buffer is full the oldest records are overwritten, so it
+ * always holds the most recent traffic. Recording a byte takes a call to
+ * micros() and four bytes of the buffer, so unlike IPOD_SERIAL_DEBUG it
+ * doesn't disturb the timing of whatever you're trying to catch.
+ *
+ * dump() writes the trace to any Print (a spare serial port, or a Print
+ * of your own that writes to EEPROM or an SD card) in this form, with
+ * multi-byte numbers big-endian:
+ *
+ *     "AAPT"                 magic
+ *     1 byte                 format version (FORMAT_VERSION)
+ *     4 bytes                number of records that follow
+ *     4 bytes per record     type, data byte, 2-byte time delta
+ *
+ * Each record's delta is the time since the previous record, in
+ * microseconds, or in milliseconds for RECORD_GAP records, which are put
+ * in before a record when the time since the last one is too long to fit
+ * (and have no data byte). The first record's delta is meaningless, since
+ * what it was measured from may have been overwritten.
+ *
+ * extras/host/trace_replay plays a dumped trace back through the library.
+ */
+class AAPWireTrace
+{
+public: // enums
+    enum RecordType
+    {
+        RECORD_RECEIVED = 1, // a byte from the iPod
+        RECORD_SENT,         // a byte to the iPod
+        RECORD_GAP           // just time passing
+    };
+
+public: // attributes
+    static const byte FORMAT_VERSION = 1;
+    static const size_t RECORD_SIZE = 4;
+
+public: // methods
+    AAPWireTrace();
+
+    /**
+     * Gives the trace a buffer to record into, or turns tracing off if
+     * size is less than RECORD_SIZE. Throws away anything already recorded.
+     */
+    void setBuffer(byte *pBuffer, size_t size);
+    bool isEnabled() const;
+
+    /**
+     * Records some bytes sent or received, all with the current time.
+     */
+    void record(RecordType type, const byte *pData, size_t length);
+
+    /**
+     * How many records the trace holds.
+     */
+    size_t recordCount() const;
+
+    /**
+     * Writes the trace, oldest record first, in the form described above.
+     * Returns the number of bytes written.
+     */
+    size_t dump(Print &out) const;
+
+    void clear();
+
+private: // attributes
+    byte *pBuffer;
+    size_t capacity; // in records
+    size_t head;     // the oldest record
+    size_t count;
+    unsigned long lastMicros;
+
+private: // methods
+    void add(RecordType type, byte data, unsigned int delta);
+};
+
+#endif // AAP_WIRE_TRACE
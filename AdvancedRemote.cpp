@@ -25,304 +25,419 @@
 #include "AdvancedRemote.h"
 
 AdvancedRemote::AdvancedRemote()
-    : pFeedbackHandler(0),
-      piPodNameHandler(0),
-      pItemCountHandler(0),
-      pItemNameHandler(0),
-      pTimeAndStatusHandler(0),
-      pPlaylistPositionHandler(0),
-      pTitleHandler(0),
-      pArtistHandler(0),
-      pAlbumHandler(0),
-      pPollingHandler(0),
-      pShuffleModeHandler(0),
-      pRepeatModeHandler(0),
-      pCurrentPlaylistSongCountHandler(0),
+    : stringViewSlots(0),
       currentlyEnabled(false)
+#if IPOD_SERIAL_REQUEST_TIMEOUTS
+    ,
+      pTimeoutHandler(0),
+      pendingRequestCount(0),
+      requestTimeoutMillis(0),
+      requestRetries(0)
+#endif
+{
+    for (byte i = 0; i < HANDLER_COUNT; ++i)
+    {
+        pHandlers[i] = 0;
+    }
+
+#if IPOD_SERIAL_LATENCY_HISTOGRAMS
+    resetLatencyHistograms();
+#endif
+}
+
+#define ADVANCED_REMOTE_DESCRIPTOR(name, opcode, layout, minParams) {layout, minParams},
+
+const AdvancedRemote::ResponseDescriptor AdvancedRemote::RESPONSES[HANDLER_COUNT] PROGMEM =
 {
+    ADVANCED_REMOTE_RESPONSES(ADVANCED_REMOTE_DESCRIPTOR)
+};
+
+#define ADVANCED_REMOTE_SLOT_OF(name, value, layout, minParams) \
+    (opcode == (value)) ? (byte) HANDLER_##name :
+
+// only used to fill in SLOTS_BY_OPCODE, while compiling
+constexpr byte AdvancedRemote::slotOf(byte opcode)
+{
+    return ADVANCED_REMOTE_RESPONSES(ADVANCED_REMOTE_SLOT_OF) (byte) HANDLER_COUNT;
+}
+
+#define ADVANCED_REMOTE_SLOTS_OF_8(first) \
+    slotOf(first), slotOf(first + 1), slotOf(first + 2), slotOf(first + 3), \
+    slotOf(first + 4), slotOf(first + 5), slotOf(first + 6), slotOf(first + 7),
+
+const byte AdvancedRemote::SLOTS_BY_OPCODE[RESPONSE_OPCODE_LIMIT] PROGMEM =
+{
+    ADVANCED_REMOTE_SLOTS_OF_8(0x00)
+    ADVANCED_REMOTE_SLOTS_OF_8(0x08)
+    ADVANCED_REMOTE_SLOTS_OF_8(0x10)
+    ADVANCED_REMOTE_SLOTS_OF_8(0x18)
+    ADVANCED_REMOTE_SLOTS_OF_8(0x20)
+    ADVANCED_REMOTE_SLOTS_OF_8(0x28)
+    ADVANCED_REMOTE_SLOTS_OF_8(0x30)
+};
+
+void AdvancedRemote::setHandler(HandlerSlot slot, GenericHandler_t *pHandler, bool stringView)
+{
+    pHandlers[slot] = pHandler;
+    if (stringView)
+    {
+        stringViewSlots |= (1U << slot);
+    }
+    else
+    {
+        stringViewSlots &= ~(1U << slot);
+    }
 }
 
 void AdvancedRemote::setFeedbackHandler(FeedbackHandler_t newHandler)
 {
-    pFeedbackHandler = newHandler;
+    setHandler(HANDLER_FEEDBACK, (GenericHandler_t *) newHandler);
 }
 
 void AdvancedRemote::setiPodNameHandler(iPodNameHandler_t newHandler)
 {
-    piPodNameHandler = newHandler;
+    setHandler(HANDLER_IPOD_NAME, (GenericHandler_t *) newHandler);
+}
+
+void AdvancedRemote::setiPodNameHandler(iPodNameViewHandler_t newHandler)
+{
+    setHandler(HANDLER_IPOD_NAME, (GenericHandler_t *) newHandler, true);
 }
 
 void AdvancedRemote::setItemCountHandler(ItemCountHandler_t newHandler)
 {
-    pItemCountHandler = newHandler;
+    setHandler(HANDLER_ITEM_COUNT, (GenericHandler_t *) newHandler);
 }
 
 void AdvancedRemote::setItemNameHandler(ItemNameHandler_t newHandler)
 {
-    pItemNameHandler = newHandler;
+    setHandler(HANDLER_ITEM_NAME, (GenericHandler_t *) newHandler);
+}
+
+void AdvancedRemote::setItemNameHandler(ItemNameViewHandler_t newHandler)
+{
+    setHandler(HANDLER_ITEM_NAME, (GenericHandler_t *) newHandler, true);
 }
 
 void AdvancedRemote::setTimeAndStatusHandler(TimeAndStatusHandler_t newHandler)
 {
-    pTimeAndStatusHandler = newHandler;
+    setHandler(HANDLER_TIME_AND_STATUS, (GenericHandler_t *) newHandler);
 }
 
 void AdvancedRemote::setPlaylistPositionHandler(PlaylistPositionHandler_t newHandler)
 {
-    pPlaylistPositionHandler = newHandler;
+    setHandler(HANDLER_PLAYLIST_POSITION, (GenericHandler_t *) newHandler);
 }
 
 void AdvancedRemote::setTitleHandler(TitleHandler_t newHandler)
 {
-    pTitleHandler = newHandler;
+    setHandler(HANDLER_TITLE, (GenericHandler_t *) newHandler);
+}
+
+void AdvancedRemote::setTitleHandler(TitleViewHandler_t newHandler)
+{
+    setHandler(HANDLER_TITLE, (GenericHandler_t *) newHandler, true);
 }
 
 void AdvancedRemote::setArtistHandler(ArtistHandler_t newHandler)
 {
-    pArtistHandler = newHandler;
+    setHandler(HANDLER_ARTIST, (GenericHandler_t *) newHandler);
+}
+
+void AdvancedRemote::setArtistHandler(ArtistViewHandler_t newHandler)
+{
+    setHandler(HANDLER_ARTIST, (GenericHandler_t *) newHandler, true);
 }
 
 void AdvancedRemote::setAlbumHandler(AlbumHandler_t newHandler)
 {
-    pAlbumHandler = newHandler;
+    setHandler(HANDLER_ALBUM, (GenericHandler_t *) newHandler);
+}
+
+void AdvancedRemote::setAlbumHandler(AlbumViewHandler_t newHandler)
+{
+    setHandler(HANDLER_ALBUM, (GenericHandler_t *) newHandler, true);
 }
 
 void AdvancedRemote::setPollingHandler(PollingHandler_t newHandler)
 {
-    pPollingHandler = newHandler;
+    setHandler(HANDLER_POLLING, (GenericHandler_t *) newHandler);
 }
 
 void AdvancedRemote::setShuffleModeHandler(ShuffleModeHandler_t newHandler)
 {
-    pShuffleModeHandler = newHandler;
+    setHandler(HANDLER_SHUFFLE_MODE, (GenericHandler_t *) newHandler);
 }
 
 void AdvancedRemote::setRepeatModeHandler(RepeatModeHandler_t newHandler)
 {
-    pRepeatModeHandler = newHandler;
+    setHandler(HANDLER_REPEAT_MODE, (GenericHandler_t *) newHandler);
 }
 
 void AdvancedRemote::setCurrentPlaylistSongCountHandler(CurrentPlaylistSongCountHandler_t newHandler)
 {
-    pCurrentPlaylistSongCountHandler = newHandler;
+    setHandler(HANDLER_CURRENT_PLAYLIST_SONG_COUNT, (GenericHandler_t *) newHandler);
 }
 
-void AdvancedRemote::enable()
+#if IPOD_SERIAL_REQUEST_TIMEOUTS
+void AdvancedRemote::setTimeoutHandler(TimeoutHandler_t newHandler)
 {
-#if defined(IPOD_SERIAL_DEBUG)
-    log("enabling advanced remote mode");
+    pTimeoutHandler = newHandler;
+}
+
+void AdvancedRemote::setRequestTimeout(unsigned long timeoutMillis, byte retries)
+{
+    requestTimeoutMillis = timeoutMillis;
+    requestRetries = retries;
+
+    if (!requestTimeoutMillis)
+    {
+        pendingRequestCount = 0;
+    }
+}
+
+byte AdvancedRemote::getPendingRequestCount()
+{
+    return pendingRequestCount;
+}
+#endif
+
+void AdvancedRemote::loop()
+{
+    iPodSerialT<AdvancedRemote>::loop();
+
+#if IPOD_SERIAL_REQUEST_TIMEOUTS
+    if (pendingRequestCount)
+    {
+        checkRequestTimeouts();
+    }
+#endif
+}
+
+bool AdvancedRemote::enable()
+{
+#if IPOD_SERIAL_LOG_LEVEL >= IPOD_SERIAL_LOG_INFO
+    log(PSTR("enabling advanced remote mode"));
 #endif
-    sendCommand(MODE_SWITCHING_MODE, 0x01, ADVANCED_REMOTE_MODE);
+    if (!sendCommand(MODE_SWITCHING_MODE, 0x01, ADVANCED_REMOTE_MODE))
+    {
+        return false;
+    }
     currentlyEnabled = true; // strictly it's not until we get feedback of success
+    return true;
 }
 
-void AdvancedRemote::disable()
+bool AdvancedRemote::disable()
 {
-#if defined(IPOD_SERIAL_DEBUG)
-    log("disabling advanced remote mode");
+#if IPOD_SERIAL_LOG_LEVEL >= IPOD_SERIAL_LOG_INFO
+    log(PSTR("disabling advanced remote mode"));
 #endif
-    sendCommand(MODE_SWITCHING_MODE, 0x01, SIMPLE_REMOTE_MODE);
+    if (!sendCommand(MODE_SWITCHING_MODE, 0x01, SIMPLE_REMOTE_MODE))
+    {
+        return false;
+    }
     currentlyEnabled = false; // strictly it's not until we get feedback of success
+#if IPOD_SERIAL_REQUEST_TIMEOUTS
+    pendingRequestCount = 0;  // and nothing else is going to be answered
+#endif
+    return true;
 }
 
-void AdvancedRemote::getiPodName()
+bool AdvancedRemote::getiPodName()
 {
-#if defined(IPOD_SERIAL_DEBUG)
-    log("getiPodName");
+#if IPOD_SERIAL_LOG_LEVEL >= IPOD_SERIAL_LOG_INFO
+    log(PSTR("getiPodName"));
 #endif
-    sendCommand(ADVANCED_REMOTE_MODE, 0x00, CMD_GET_IPOD_NAME);
+    return sendCommand(ADVANCED_REMOTE_MODE, 0x00, CMD_GET_IPOD_NAME);
 }
 
-void AdvancedRemote::switchToMainLibraryPlaylist()
+bool AdvancedRemote::switchToMainLibraryPlaylist()
 {
-#if defined(IPOD_SERIAL_DEBUG)
-    log("switchToMainLibraryPlaylist");
+#if IPOD_SERIAL_LOG_LEVEL >= IPOD_SERIAL_LOG_INFO
+    log(PSTR("switchToMainLibraryPlaylist"));
 #endif
-    sendCommand(ADVANCED_REMOTE_MODE, 0x00, CMD_SWITCH_TO_MAIN_LIBRARY_PLAYLIST);
+    return sendCommand(ADVANCED_REMOTE_MODE, 0x00, CMD_SWITCH_TO_MAIN_LIBRARY_PLAYLIST);
 }
 
-void AdvancedRemote::switchToItem(AdvancedRemote::ItemType itemType, long index)
+bool AdvancedRemote::switchToItem(AdvancedRemote::ItemType itemType, long index)
 {
-#if defined(IPOD_SERIAL_DEBUG)
-    log("switchToItem");
+#if IPOD_SERIAL_LOG_LEVEL >= IPOD_SERIAL_LOG_INFO
+    log(PSTR("switchToItem"));
 #endif
-    sendCommandWithOneByteAndOneNumberParam(ADVANCED_REMOTE_MODE, 0x00, CMD_SWITCH_TO_ITEM, itemType, index);
+    return sendCommand(ADVANCED_REMOTE_MODE, 0x00, CMD_SWITCH_TO_ITEM, (byte) itemType, index);
 }
 
-void AdvancedRemote::getItemCount(AdvancedRemote::ItemType itemType)
+bool AdvancedRemote::getItemCount(AdvancedRemote::ItemType itemType)
 {
-#if defined(IPOD_SERIAL_DEBUG)
-    log("getItemCount");
+#if IPOD_SERIAL_LOG_LEVEL >= IPOD_SERIAL_LOG_INFO
+    log(PSTR("getItemCount"));
 #endif
-    sendCommandWithOneByteParam(ADVANCED_REMOTE_MODE, 0x00, CMD_GET_ITEM_COUNT, itemType);
+    return sendCommand(ADVANCED_REMOTE_MODE, 0x00, CMD_GET_ITEM_COUNT, (byte) itemType);
 }
 
-void AdvancedRemote::getItemNames(AdvancedRemote::ItemType itemType, unsigned long offset, unsigned long count)
+bool AdvancedRemote::getItemNames(AdvancedRemote::ItemType itemType, unsigned long offset, unsigned long count)
 {
-#if defined(IPOD_SERIAL_DEBUG)
-    log("getItemNames");
+#if IPOD_SERIAL_LOG_LEVEL >= IPOD_SERIAL_LOG_INFO
+    log(PSTR("getItemNames"));
 #endif
-    sendCommandWithOneByteAndTwoNumberParams(ADVANCED_REMOTE_MODE, 0x00, CMD_GET_ITEM_NAMES, itemType, offset, count);
+    return sendCommand(ADVANCED_REMOTE_MODE, 0x00, CMD_GET_ITEM_NAMES, (byte) itemType, offset, count);
 }
 
-void AdvancedRemote::getTimeAndStatusInfo()
+bool AdvancedRemote::getTimeAndStatusInfo()
 {
-#if defined(IPOD_SERIAL_DEBUG)
-    log("getTimeAndStatusInfo");
+#if IPOD_SERIAL_LOG_LEVEL >= IPOD_SERIAL_LOG_INFO
+    log(PSTR("getTimeAndStatusInfo"));
 #endif
-    sendCommand(ADVANCED_REMOTE_MODE, 0x00, CMD_GET_TIME_AND_STATUS_INFO);
+    return sendCommand(ADVANCED_REMOTE_MODE, 0x00, CMD_GET_TIME_AND_STATUS_INFO);
 }
 
-void AdvancedRemote::getPlaylistPosition()
+bool AdvancedRemote::getPlaylistPosition()
 {
-#if defined(IPOD_SERIAL_DEBUG)
-    log("getPlaylistPosition");
+#if IPOD_SERIAL_LOG_LEVEL >= IPOD_SERIAL_LOG_INFO
+    log(PSTR("getPlaylistPosition"));
 #endif
-    sendCommand(ADVANCED_REMOTE_MODE, 0x00, CMD_GET_PLAYLIST_POSITION);
+    return sendCommand(ADVANCED_REMOTE_MODE, 0x00, CMD_GET_PLAYLIST_POSITION);
 }
 
-void AdvancedRemote::getTitle(unsigned long index)
+bool AdvancedRemote::getTitle(unsigned long index)
 {
-#if defined(IPOD_SERIAL_DEBUG)
-    log("getTitle");
+#if IPOD_SERIAL_LOG_LEVEL >= IPOD_SERIAL_LOG_INFO
+    log(PSTR("getTitle"));
 #endif
-    sendCommandWithOneNumberParam(ADVANCED_REMOTE_MODE, 0x00, CMD_GET_TITLE, index);
+    return sendCommand(ADVANCED_REMOTE_MODE, 0x00, CMD_GET_TITLE, index);
 }
 
-void AdvancedRemote::getArtist(unsigned long index)
+bool AdvancedRemote::getArtist(unsigned long index)
 {
-#if defined(IPOD_SERIAL_DEBUG)
-    log("getArtist");
+#if IPOD_SERIAL_LOG_LEVEL >= IPOD_SERIAL_LOG_INFO
+    log(PSTR("getArtist"));
 #endif
-    sendCommandWithOneNumberParam(ADVANCED_REMOTE_MODE, 0x00, CMD_GET_ARTIST, index);
+    return sendCommand(ADVANCED_REMOTE_MODE, 0x00, CMD_GET_ARTIST, index);
 }
 
-void AdvancedRemote::getAlbum(unsigned long index)
+bool AdvancedRemote::getAlbum(unsigned long index)
 {
-#if defined(IPOD_SERIAL_DEBUG)
-    log("getAlbum");
+#if IPOD_SERIAL_LOG_LEVEL >= IPOD_SERIAL_LOG_INFO
+    log(PSTR("getAlbum"));
 #endif
-    sendCommandWithOneNumberParam(ADVANCED_REMOTE_MODE, 0x00, CMD_GET_ALBUM, index);
+    return sendCommand(ADVANCED_REMOTE_MODE, 0x00, CMD_GET_ALBUM, index);
 }
 
-void AdvancedRemote::setPollingMode(AdvancedRemote::PollingMode newMode)
+bool AdvancedRemote::setPollingMode(AdvancedRemote::PollingMode newMode)
 {
-#if defined(IPOD_SERIAL_DEBUG)
-    log("setPollingMode");
+#if IPOD_SERIAL_LOG_LEVEL >= IPOD_SERIAL_LOG_INFO
+    log(PSTR("setPollingMode"));
 #endif
-    sendCommandWithOneByteParam(ADVANCED_REMOTE_MODE, 0x00, CMD_POLLING_MODE, newMode);
+    return sendCommand(ADVANCED_REMOTE_MODE, 0x00, CMD_POLLING_MODE, (byte) newMode);
 }
 
-void AdvancedRemote::executeSwitch(unsigned long index)
+bool AdvancedRemote::executeSwitch(unsigned long index)
 {
-#if defined(IPOD_SERIAL_DEBUG)
-    log("executeSwitch");
+#if IPOD_SERIAL_LOG_LEVEL >= IPOD_SERIAL_LOG_INFO
+    log(PSTR("executeSwitch"));
 #endif
-    sendCommandWithOneNumberParam(ADVANCED_REMOTE_MODE, 0x00, CMD_EXECUTE_SWITCH, index);
+    return sendCommand(ADVANCED_REMOTE_MODE, 0x00, CMD_EXECUTE_SWITCH, index);
 }
 
-void AdvancedRemote::controlPlayback(AdvancedRemote::PlaybackControl command)
+bool AdvancedRemote::controlPlayback(AdvancedRemote::PlaybackControl command)
 {
-#if defined(IPOD_SERIAL_DEBUG)
-    log("controlPlayback");
+#if IPOD_SERIAL_LOG_LEVEL >= IPOD_SERIAL_LOG_INFO
+    log(PSTR("controlPlayback"));
 #endif
-    sendCommandWithOneByteParam(ADVANCED_REMOTE_MODE, 0x00, CMD_PLAYBACK_CONTROL, command);
+    return sendCommand(ADVANCED_REMOTE_MODE, 0x00, CMD_PLAYBACK_CONTROL, (byte) command);
 }
 
-void AdvancedRemote::getShuffleMode()
+bool AdvancedRemote::getShuffleMode()
 {
-#if defined(IPOD_SERIAL_DEBUG)
-    log("getShuffleMode");
+#if IPOD_SERIAL_LOG_LEVEL >= IPOD_SERIAL_LOG_INFO
+    log(PSTR("getShuffleMode"));
 #endif
-    sendCommand(ADVANCED_REMOTE_MODE, 0x00, CMD_GET_SHUFFLE_MODE);
+    return sendCommand(ADVANCED_REMOTE_MODE, 0x00, CMD_GET_SHUFFLE_MODE);
 }
 
-void AdvancedRemote::setShuffleMode(AdvancedRemote::ShuffleMode newMode)
+bool AdvancedRemote::setShuffleMode(AdvancedRemote::ShuffleMode newMode)
 {
-#if defined(IPOD_SERIAL_DEBUG)
-    log("setShuffleMode");
+#if IPOD_SERIAL_LOG_LEVEL >= IPOD_SERIAL_LOG_INFO
+    log(PSTR("setShuffleMode"));
 #endif
-    sendCommandWithOneByteParam(ADVANCED_REMOTE_MODE, 0x00, CMD_SET_SHUFFLE_MODE, newMode);
+    return sendCommand(ADVANCED_REMOTE_MODE, 0x00, CMD_SET_SHUFFLE_MODE, (byte) newMode);
 }
 
-void AdvancedRemote::getRepeatMode()
+bool AdvancedRemote::getRepeatMode()
 {
-#if defined(IPOD_SERIAL_DEBUG)
-    log("getRepeatMode");
+#if IPOD_SERIAL_LOG_LEVEL >= IPOD_SERIAL_LOG_INFO
+    log(PSTR("getRepeatMode"));
 #endif
-    sendCommand(ADVANCED_REMOTE_MODE, 0x00, CMD_GET_REPEAT_MODE);
+    return sendCommand(ADVANCED_REMOTE_MODE, 0x00, CMD_GET_REPEAT_MODE);
 }
 
-void AdvancedRemote::setRepeatMode(AdvancedRemote::RepeatMode newMode)
+bool AdvancedRemote::setRepeatMode(AdvancedRemote::RepeatMode newMode)
 {
-#if defined(IPOD_SERIAL_DEBUG)
-    log("setRepeatMode");
+#if IPOD_SERIAL_LOG_LEVEL >= IPOD_SERIAL_LOG_INFO
+    log(PSTR("setRepeatMode"));
 #endif
-    sendCommandWithOneByteParam(ADVANCED_REMOTE_MODE, 0x00, CMD_SET_REPEAT_MODE, newMode);
+    return sendCommand(ADVANCED_REMOTE_MODE, 0x00, CMD_SET_REPEAT_MODE, (byte) newMode);
 }
 
-void AdvancedRemote::getSongCountInCurrentPlaylist()
+bool AdvancedRemote::getSongCountInCurrentPlaylist()
 {
-#if defined(IPOD_SERIAL_DEBUG)
-    log("getSongCountInCurrentPlaylist");
+#if IPOD_SERIAL_LOG_LEVEL >= IPOD_SERIAL_LOG_INFO
+    log(PSTR("getSongCountInCurrentPlaylist"));
 #endif
-    sendCommand(ADVANCED_REMOTE_MODE, 0x00, CMD_GET_SONG_COUNT_IN_CURRENT_PLAYLIST);
+    return sendCommand(ADVANCED_REMOTE_MODE, 0x00, CMD_GET_SONG_COUNT_IN_CURRENT_PLAYLIST);
 }
 
-void AdvancedRemote::jumpToSongInCurrentPlaylist(unsigned long index)
+bool AdvancedRemote::jumpToSongInCurrentPlaylist(unsigned long index)
 {
-#if defined(IPOD_SERIAL_DEBUG)
-    log("jumpToSongInCurrentPlaylist");
+#if IPOD_SERIAL_LOG_LEVEL >= IPOD_SERIAL_LOG_INFO
+    log(PSTR("jumpToSongInCurrentPlaylist"));
 #endif
-    sendCommandWithOneNumberParam(ADVANCED_REMOTE_MODE, 0x00, CMD_JUMP_TO_SONG_IN_CURRENT_PLAYLIST, index);
+    return sendCommand(ADVANCED_REMOTE_MODE, 0x00, CMD_JUMP_TO_SONG_IN_CURRENT_PLAYLIST, index);
 }
 
 void AdvancedRemote::processData()
 {
+    if (dataSize < 3)
+    {
+        // too short to have a mode and command; nothing we can do with it
+        frameUnhandled();
+        return;
+    }
+
     const byte mode = dataBuffer[0];
     if (mode != ADVANCED_REMOTE_MODE)
     {
-#if defined(IPOD_SERIAL_DEBUG)
-        if (pDebugPrint)
-        {
-            pDebugPrint->println("response not for adv mode so ignoring");
-            dumpReceive();
-        }
+#if IPOD_SERIAL_LOG_LEVEL >= IPOD_SERIAL_LOG_INFO
+        debug(PSTR("response not for adv mode so ignoring"));
+        dumpReceive();
 #endif
+        frameUnhandled();
         return;
     }
 
     const byte firstCommandByte = dataBuffer[1];
     if (firstCommandByte != 0x00)
     {
-#if defined(IPOD_SERIAL_DEBUG)
-        if (pDebugPrint)
-        {
-            pDebugPrint->println("1st cmd byte in response not 0x00 so ignoring");
-            dumpReceive();
-        }
+#if IPOD_SERIAL_LOG_LEVEL >= IPOD_SERIAL_LOG_INFO
+        debug(PSTR("1st cmd byte in response not 0x00 so ignoring"));
+        dumpReceive();
 #endif
+        frameUnhandled();
         return;
     }
 
-    const byte secondCommandByte = dataBuffer[2];
-    switch (secondCommandByte)
+    const byte opcode = dataBuffer[2];
+    if (opcode == RESPONSE_BAD)
     {
-    case RESPONSE_BAD:
-#if defined(IPOD_SERIAL_DEBUG)
-        if (pDebugPrint)
-        {
-            pDebugPrint->print("BAD Response: Result=0x");
-            pDebugPrint->print(dataBuffer[3], HEX);
-            pDebugPrint->print(", Command=0x");
-            pDebugPrint->print(dataBuffer[4], HEX);
-            pDebugPrint->print(", 0x");
-            pDebugPrint->println(dataBuffer[5], HEX);
-        }
+#if IPOD_SERIAL_LOG_LEVEL >= IPOD_SERIAL_LOG_ERROR
+        debugBytes(PSTR("BAD Response: Result, Command:"), &dataBuffer[3], 3);
 #endif
+        frameUnhandled();
         return;
+    }
 
-    case RESPONSE_FEEDBACK:
+    if (opcode == RESPONSE_FEEDBACK)
+    {
         /*
          * Result:
          * 0=success,
@@ -330,138 +445,659 @@ void AdvancedRemote::processData()
          * 4=you exceeded the limit of whatever you were requesting/wrong parameter-count,
          * 5=sent an iPod Response instead of a command
          */
-#if defined(IPOD_SERIAL_DEBUG)
-        if (pDebugPrint)
+#if IPOD_SERIAL_LOG_LEVEL >= IPOD_SERIAL_LOG_INFO
+        debugBytes(PSTR("Feedback Response: Result, Command:"), &dataBuffer[3], 3);
+#endif
+        if (hasParams(3))
         {
-            pDebugPrint->print("Feedback Response: Result=0x");
-            pDebugPrint->print(dataBuffer[3], HEX);
-            pDebugPrint->print(", Command=0x");
-            pDebugPrint->print(dataBuffer[4], HEX);
-            pDebugPrint->print(", 0x");
-            pDebugPrint->println(dataBuffer[5], HEX);
-        }
+#if IPOD_SERIAL_REQUEST_TIMEOUTS
+            requestAnswered(dataBuffer[5], true);
+#endif
+#if IPOD_SERIAL_LATENCY_HISTOGRAMS
+            commandAnswered(dataBuffer[5]);
 #endif
-        if (pFeedbackHandler)
+        }
+    }
+    else
+    {
+        // if we made it past that, hopefully this is a response
+        // to a command that we sent
+        const byte commandThisIsAResponseFor = opcode - 1;
+        // -1 because response number is always cmd number + 1
+
+        // polling responses arrive unasked for, rather than answering the
+        // setPollingMode request (which gets feedback)
+        if (commandThisIsAResponseFor != CMD_POLLING_MODE)
         {
-            const Feedback feedback = (Feedback) dataBuffer[3];
-            pFeedbackHandler(feedback, dataBuffer[5]);
+#if IPOD_SERIAL_LATENCY_HISTOGRAMS
+            commandAnswered(commandThisIsAResponseFor);
+#endif
+#if IPOD_SERIAL_REQUEST_TIMEOUTS
+            if (!requestAnswered(commandThisIsAResponseFor, false))
+            {
+#if IPOD_SERIAL_LOG_LEVEL >= IPOD_SERIAL_LOG_INFO
+                debug(PSTR("item name already had, or out of turn, dropping it"));
+#endif
+                frameUnhandled();
+                return;
+            }
+#endif
         }
+    }
+
+    HandlerSlot slot;
+    if (!slotFor(opcode, slot))
+    {
+#if IPOD_SERIAL_LOG_LEVEL >= IPOD_SERIAL_LOG_INFO
+        debug(PSTR("unsupported response:"));
+        dumpReceive();
+#endif
+        frameUnhandled();
         return;
     }
-    // if we made it past that, hopefully this is a response
-    // to a command that we sent
 
-    const byte commandThisIsAResponseFor = secondCommandByte - 1;
-    // -1 because response number is always cmd number + 1
+    if (!pHandlers[slot] || !hasParams(pgm_read_byte(&RESPONSES[slot].minParams)))
+    {
+        frameUnhandled();
+        return;
+    }
+
+    callHandler(slot, &dataBuffer[3]);
+}
+
+bool AdvancedRemote::wantsFrame()
+{
+    // only what processData() would do something with
+    if ((dataBuffer[0] != ADVANCED_REMOTE_MODE) || (dataBuffer[1] != 0x00))
+    {
+        return false;
+    }
+
+    const byte opcode = dataBuffer[2];
+    if (opcode == RESPONSE_BAD)
+    {
+        // it's only of interest to the log
+        return IPOD_SERIAL_LOG_LEVEL >= IPOD_SERIAL_LOG_ERROR;
+    }
+
+#if IPOD_SERIAL_REQUEST_TIMEOUTS || IPOD_SERIAL_LATENCY_HISTOGRAMS
+    // the answer to something we're waiting on is needed even if
+    // nobody has a handler for it, to stop waiting
+    if (isAwaited(opcode))
+    {
+        return true;
+    }
+#endif
+
+    HandlerSlot slot;
+    return slotFor(opcode, slot) &&
+           pHandlers[slot] &&
+           hasParams(pgm_read_byte(&RESPONSES[slot].minParams));
+}
+
+bool AdvancedRemote::wantsFrameTruncated()
+{
+    // only string handlers that are given the length can be told the
+    // string was cut short
+    HandlerSlot slot;
+    return slotFor(dataBuffer[2], slot) &&
+           pHandlers[slot] &&
+           (stringViewSlots & (1U << slot));
+}
+
+#if IPOD_SERIAL_REQUEST_TIMEOUTS || IPOD_SERIAL_LATENCY_HISTOGRAMS
+bool AdvancedRemote::isAwaited(byte opcode)
+{
+    // Feedback only says which command it's for after the bytes we've
+    // seen so far, so it could be for any of them.
+    const bool feedback = (opcode == RESPONSE_FEEDBACK);
+    const byte cmd = opcode - 1;
+    if (!feedback && (cmd == CMD_POLLING_MODE))
+    {
+        // polling responses arrive unasked for
+        return false;
+    }
 
-    const byte *pData = &dataBuffer[3];
-    switch (commandThisIsAResponseFor)
+#if IPOD_SERIAL_REQUEST_TIMEOUTS
+    for (byte i = 0; i < pendingRequestCount; ++i)
     {
-    case CMD_GET_IPOD_NAME:
-        if (piPodNameHandler)
+        if (feedback || (pendingRequests[i].data[2] == cmd))
         {
-            piPodNameHandler((const char *) pData);
+            return true;
         }
+    }
+#endif
+#if IPOD_SERIAL_LATENCY_HISTOGRAMS
+    for (byte i = 0; i < commandsInFlightCount; ++i)
+    {
+        if (feedback || (commandsInFlight[i].cmd == cmd))
+        {
+            return true;
+        }
+    }
+#endif
+    return false;
+}
+#endif
+
+bool AdvancedRemote::slotFor(byte opcode, HandlerSlot &slot)
+{
+    // every opcode must have a place in SLOTS_BY_OPCODE, and every place
+    // must have been filled in rather than left as 0 (HANDLER_FEEDBACK)
+#define ADVANCED_REMOTE_OPCODE_FITS(name, value, layout, minParams) \
+    static_assert((value) < RESPONSE_OPCODE_LIMIT, "SLOTS_BY_OPCODE is too short for " #name);
+    ADVANCED_REMOTE_RESPONSES(ADVANCED_REMOTE_OPCODE_FITS)
+#undef ADVANCED_REMOTE_OPCODE_FITS
+    static_assert(RESPONSE_OPCODE_LIMIT == 7 * 8, "SLOTS_BY_OPCODE's initialiser is the wrong length");
+
+    if (opcode >= RESPONSE_OPCODE_LIMIT)
+    {
+        return false;
+    }
+
+    const byte found = pgm_read_byte(&SLOTS_BY_OPCODE[opcode]);
+    if (found == HANDLER_COUNT)
+    {
+        return false;
+    }
+
+    slot = (HandlerSlot) found;
+    return true;
+}
+
+void AdvancedRemote::callHandler(HandlerSlot slot, const byte *pData)
+{
+    GenericHandler_t *pHandler = pHandlers[slot];
+
+    switch (pgm_read_byte(&RESPONSES[slot].layout))
+    {
+    case LAYOUT_FEEDBACK:
+        IPOD_SERIAL_PROFILED_HANDLER(((FeedbackHandler_t *) pHandler)((Feedback) pData[0], pData[2]));
         break;
 
-    case CMD_GET_ITEM_COUNT:
-        if (pItemCountHandler)
+    case LAYOUT_STRING:
+        if (stringViewSlots & (1U << slot))
         {
-            pItemCountHandler(endianConvert(pData));
+            const size_t length = dataSize - 3;
+            const bool complete = !frameTruncated() && (length > 0) && (pData[length - 1] == 0);
+            IPOD_SERIAL_PROFILED_HANDLER(((TitleViewHandler_t *) pHandler)(
+                (const char *) pData, complete ? length - 1 : length, complete));
         }
+        else
+        {
+            IPOD_SERIAL_PROFILED_HANDLER(((TitleHandler_t *) pHandler)((const char *) pData));
+        }
+        break;
+
+    case LAYOUT_NUMBER:
+        IPOD_SERIAL_PROFILED_HANDLER(((ItemCountHandler_t *) pHandler)(endianConvert(pData)));
         break;
 
-    case CMD_GET_ITEM_NAMES:
-        if (pItemNameHandler)
+    case LAYOUT_NUMBER_AND_STRING:
+        if (stringViewSlots & (1U << slot))
+        {
+            const size_t length = dataSize - 3 - 4;
+            const bool complete = !frameTruncated() && (length > 0) && (pData[4 + length - 1] == 0);
+            IPOD_SERIAL_PROFILED_HANDLER(((ItemNameViewHandler_t *) pHandler)(
+                endianConvert(pData), (const char *) (pData + 4), complete ? length - 1 : length, complete));
+        }
+        else
         {
-            const unsigned long itemOffset = endianConvert(pData);
-            const char *itemName = (const char *) (pData + 4);
-            pItemNameHandler(itemOffset, itemName);
+            IPOD_SERIAL_PROFILED_HANDLER(((ItemNameHandler_t *) pHandler)(endianConvert(pData), (const char *) (pData + 4)));
         }
         break;
 
-    case CMD_GET_TIME_AND_STATUS_INFO:
-        if (pTimeAndStatusHandler)
+    case LAYOUT_TIME_AND_STATUS:
+        IPOD_SERIAL_PROFILED_HANDLER(((TimeAndStatusHandler_t *) pHandler)(
+            endianConvert(pData), endianConvert(pData + 4), (PlaybackStatus) pData[8]));
+        break;
+
+    case LAYOUT_POLLING:
+        IPOD_SERIAL_PROFILED_HANDLER(((PollingHandler_t *) pHandler)((PollingCommand) pData[0], endianConvert(pData + 1)));
+        break;
+
+    case LAYOUT_SHUFFLE_MODE:
+        IPOD_SERIAL_PROFILED_HANDLER(((ShuffleModeHandler_t *) pHandler)((ShuffleMode) pData[0]));
+        break;
+
+    case LAYOUT_REPEAT_MODE:
+        IPOD_SERIAL_PROFILED_HANDLER(((RepeatModeHandler_t *) pHandler)((RepeatMode) pData[0]));
+        break;
+    }
+}
+
+bool AdvancedRemote::sendCommandWithLength(size_t length, const byte *pData)
+{
+    // only Advanced Remote requests get answered
+    if ((length < 3) || (pData[0] != ADVANCED_REMOTE_MODE) || (pData[1] != 0x00))
+    {
+        return sendFrame(length, pData, priorityOf(length, pData));
+    }
+
+#if IPOD_SERIAL_REQUEST_TIMEOUTS
+    const bool track = requestTimeoutMillis && (length <= MAX_REQUEST_SIZE);
+    if (track && (pendingRequestCount == IPOD_SERIAL_MAX_PENDING_REQUESTS))
+    {
+#if IPOD_SERIAL_LOG_LEVEL >= IPOD_SERIAL_LOG_ERROR
+        log(PSTR("too many pending requests, dropping command"));
+#endif
+        return false;
+    }
+#endif
+
+    if (!sendRequest(length, pData))
+    {
+        return false;
+    }
+
+#if IPOD_SERIAL_REQUEST_TIMEOUTS
+    if (track)
+    {
+        trackRequest(length, pData);
+    }
+#endif
+    return true;
+}
+
+/*
+ * Sends an Advanced Remote request, whether it's the first time or a
+ * retry, and starts timing it if the latency histograms are on.
+ */
+bool AdvancedRemote::sendRequest(size_t length, const byte *pData)
+{
+    if (!sendFrame(length, pData, priorityOf(length, pData)))
+    {
+        return false;
+    }
+
+#if IPOD_SERIAL_LATENCY_HISTOGRAMS
+    commandSent(pData[2]);
+#endif
+    return true;
+}
+
+#if IPOD_SERIAL_LATENCY_HISTOGRAMS
+#define ADVANCED_REMOTE_TIMED_COMMAND(cmd) cmd,
+
+const byte AdvancedRemote::TIMED_COMMANDS[TIMED_COMMAND_COUNT] PROGMEM =
+{
+    ADVANCED_REMOTE_TIMED_COMMANDS(ADVANCED_REMOTE_TIMED_COMMAND)
+};
+
+int AdvancedRemote::timedCommandIndex(byte cmd)
+{
+    for (byte i = 0; i < TIMED_COMMAND_COUNT; ++i)
+    {
+        if (pgm_read_byte(&TIMED_COMMANDS[i]) == cmd)
         {
-            const unsigned long trackLength = endianConvert(pData);
-            const unsigned long elapsedTime = endianConvert(pData + 4);
-            PlaybackStatus playbackStatus = (PlaybackStatus) *(pData + 8);
+            return i;
+        }
+    }
+    return -1;
+}
 
-            pTimeAndStatusHandler(trackLength, elapsedTime, playbackStatus);
+void AdvancedRemote::commandSent(byte cmd)
+{
+    if (commandsInFlightCount == IPOD_SERIAL_MAX_PENDING_REQUESTS)
+    {
+        // make room by forgetting the oldest; it's probably never coming back
+        memmove(&commandsInFlight[0], &commandsInFlight[1], (commandsInFlightCount - 1) * sizeof(commandsInFlight[0]));
+        --commandsInFlightCount;
+    }
+
+    CommandInFlight &command = commandsInFlight[commandsInFlightCount++];
+    command.cmd = cmd;
+    command.sentMicros = micros();
+}
 
+void AdvancedRemote::commandAnswered(byte cmd)
+{
+    for (byte i = 0; i < commandsInFlightCount; ++i)
+    {
+        if (commandsInFlight[i].cmd != cmd)
+        {
+            continue;
         }
-        break;
 
-    case CMD_GET_PLAYLIST_POSITION:
-        if (pPlaylistPositionHandler)
+        const unsigned long latency = micros() - commandsInFlight[i].sentMicros;
+        memmove(&commandsInFlight[i], &commandsInFlight[i + 1], (commandsInFlightCount - i - 1) * sizeof(commandsInFlight[0]));
+        --commandsInFlightCount;
+
+        const int index = timedCommandIndex(cmd);
+        if (index < 0)
         {
-            pPlaylistPositionHandler(endianConvert(pData));
+            return;
         }
-        break;
 
-    case CMD_GET_TITLE:
-        if (pTitleHandler)
+        LatencyHistogram &histogram = latencyHistograms[index];
+        byte bucket = 0;
+        for (unsigned long rest = latency >> LATENCY_SHIFT; rest && (bucket < LATENCY_BUCKETS - 1); rest >>= 1)
         {
-            pTitleHandler((const char *) pData);
+            ++bucket;
         }
-        break;
+        if (histogram.counts[bucket] < 0xFFFF)
+        {
+            ++histogram.counts[bucket];
+        }
+        if (latency < histogram.minMicros)
+        {
+            histogram.minMicros = latency;
+        }
+        if (latency > histogram.maxMicros)
+        {
+            histogram.maxMicros = latency;
+        }
+        return;
+    }
+}
 
+unsigned long AdvancedRemote::getLatencyCount(byte cmd)
+{
+    const int index = timedCommandIndex(cmd);
+    unsigned long count = 0;
+    if (index >= 0)
+    {
+        for (byte bucket = 0; bucket < LATENCY_BUCKETS; ++bucket)
+        {
+            count += latencyHistograms[index].counts[bucket];
+        }
+    }
+    return count;
+}
+
+unsigned long AdvancedRemote::getLatencyMinMicros(byte cmd)
+{
+    return getLatencyCount(cmd) ? latencyHistograms[timedCommandIndex(cmd)].minMicros : 0;
+}
 
-    case CMD_GET_ARTIST:
-        if (pArtistHandler)
+unsigned long AdvancedRemote::getLatencyMaxMicros(byte cmd)
+{
+    return getLatencyCount(cmd) ? latencyHistograms[timedCommandIndex(cmd)].maxMicros : 0;
+}
+
+unsigned long AdvancedRemote::getLatencyPercentileMicros(byte cmd, byte percentile)
+{
+    const unsigned long count = getLatencyCount(cmd);
+    if (count == 0)
+    {
+        return 0;
+    }
+
+    const LatencyHistogram &histogram = latencyHistograms[timedCommandIndex(cmd)];
+
+    // the first bucket that takes us to the percentile, rounding up
+    const unsigned long wanted = (count * percentile + 99) / 100;
+    unsigned long seen = 0;
+    byte bucket = 0;
+    for (; bucket < LATENCY_BUCKETS - 1; ++bucket)
+    {
+        seen += histogram.counts[bucket];
+        if (seen >= wanted)
         {
-            pArtistHandler((const char *) pData);
+            break;
         }
-        break;
+    }
+
+    // report the top of the bucket, as long as that's somewhere we've been
+    unsigned long micros = (1UL << (LATENCY_SHIFT + bucket)) - 1;
+    if (micros > histogram.maxMicros)
+    {
+        micros = histogram.maxMicros;
+    }
+    if (micros < histogram.minMicros)
+    {
+        micros = histogram.minMicros;
+    }
+    return micros;
+}
 
-    case CMD_GET_ALBUM:
-        if (pAlbumHandler)
+void AdvancedRemote::printLatencyHistograms(Print &out)
+{
+    for (byte i = 0; i < TIMED_COMMAND_COUNT; ++i)
+    {
+        const byte cmd = pgm_read_byte(&TIMED_COMMANDS[i]);
+        const unsigned long count = getLatencyCount(cmd);
+        if (count == 0)
         {
-            pAlbumHandler((const char *) pData);
+            continue;
         }
-        break;
 
-    case CMD_POLLING_MODE:
-        if (pPollingHandler)
+        out.print("cmd 0x");
+        out.print(cmd, HEX);
+        out.print(": n=");
+        out.print(count);
+        out.print(" min=");
+        out.print(getLatencyMinMicros(cmd));
+        out.print(" p50=");
+        out.print(getLatencyPercentileMicros(cmd, 50));
+        out.print(" p99=");
+        out.print(getLatencyPercentileMicros(cmd, 99));
+        out.print(" max=");
+        out.print(getLatencyMaxMicros(cmd));
+        out.println(" us");
+    }
+}
+
+void AdvancedRemote::resetLatencyHistograms()
+{
+    memset(latencyHistograms, 0, sizeof(latencyHistograms));
+    for (byte i = 0; i < TIMED_COMMAND_COUNT; ++i)
+    {
+        latencyHistograms[i].minMicros = 0xFFFFFFFF;
+    }
+    commandsInFlightCount = 0;
+}
+#endif
+
+iPodSerial::CommandPriority AdvancedRemote::priorityOf(size_t length, const byte *pData)
+{
+    // Things the user is waiting to hear or see happen go ahead of
+    // fetching names and polling for state, which can take a while
+    // when walking a big library.
+    if ((length >= 3) && (pData[0] == ADVANCED_REMOTE_MODE) && (pData[1] == 0x00))
+    {
+        // They mustn't overtake a background command they depend on, though,
+        // or the iPod would act on what was selected or set before it.
+        switch (pData[2])
         {
-            const PollingCommand command = (PollingCommand) pData[0];
-            const unsigned long number = endianConvert(pData + 1);
-            pPollingHandler(command, number);
+        case CMD_EXECUTE_SWITCH:
+        case CMD_JUMP_TO_SONG_IN_CURRENT_PLAYLIST:
+            // these act on what's been selected, and change what's
+            // playing like playback control does
+            if (isWaiting(CMD_SWITCH_TO_MAIN_LIBRARY_PLAYLIST) || isWaiting(CMD_SWITCH_TO_ITEM))
+            {
+                return PRIORITY_BACKGROUND;
+            }
+            // fall through
+        case CMD_PLAYBACK_CONTROL:
+            return (isWaiting(CMD_EXECUTE_SWITCH) || isWaiting(CMD_JUMP_TO_SONG_IN_CURRENT_PLAYLIST)) ? PRIORITY_BACKGROUND : PRIORITY_INTERACTIVE;
+        case CMD_SET_SHUFFLE_MODE:
+            return isWaiting(CMD_GET_SHUFFLE_MODE) ? PRIORITY_BACKGROUND : PRIORITY_INTERACTIVE;
+        case CMD_SET_REPEAT_MODE:
+            return isWaiting(CMD_GET_REPEAT_MODE) ? PRIORITY_BACKGROUND : PRIORITY_INTERACTIVE;
+        default:
+            return PRIORITY_BACKGROUND;
         }
-        break;
+    }
+
+    // mode switches and the like
+    return PRIORITY_INTERACTIVE;
+}
+
+bool AdvancedRemote::isWaiting(byte cmd)
+{
+    return isBackgroundCommandWaiting(ADVANCED_REMOTE_MODE, 0x00, cmd);
+}
+
+#if IPOD_SERIAL_REQUEST_TIMEOUTS
+/*
+ * Returns false if the response is an item name that should be dropped,
+ * because it has already been passed on, or it came after a gap that
+ * couldn't be asked for again yet.
+ */
+bool AdvancedRemote::requestAnswered(byte command, bool feedback)
+{
+    const bool itemName = !feedback && (command == CMD_GET_ITEM_NAMES) && hasParams(4);
+    const unsigned long offset = itemName ? endianConvert(&dataBuffer[3]) : 0;
+    bool asked = false;
 
-    case CMD_GET_SHUFFLE_MODE:
-        if (pShuffleModeHandler)
+    for (byte i = 0; i < pendingRequestCount; ++i)
+    {
+        PendingRequest &request = pendingRequests[i];
+        if (request.data[2] != command)
         {
-            pShuffleModeHandler((ShuffleMode) *pData);
+            continue;
         }
-        break;
 
-    case CMD_GET_REPEAT_MODE:
-        if (pRepeatModeHandler)
+        if (itemName)
         {
-            pRepeatModeHandler((RepeatMode) *pData);
+            // what was first asked for; retries only ever ask for the tail of it
+            const unsigned long askedFrom = endianConvert(&request.data[4]);
+            const unsigned long end = askedFrom + endianConvert(&request.data[8]);
+            if ((offset < askedFrom) || (offset >= end))
+            {
+                continue;
+            }
+            asked = true;
+            if (offset < request.nextOffset)
+            {
+                // had it already, unless it's one that went missing and
+                // is being asked for again by a later request
+                continue;
+            }
+            if ((offset > request.nextOffset) && !askAgainForMissing(request, offset))
+            {
+                // it'll come again when this request is retried from the
+                // first missing name
+                return false;
+            }
+            request.nextOffset = offset + 1;
+            if (request.nextOffset < end)
+            {
+                // more names to come; the timeout starts again for the next one
+                request.sentMillis = millis();
+                request.retriesLeft = requestRetries;
+                return true;
+            }
         }
-        break;
 
-    case CMD_GET_SONG_COUNT_IN_CURRENT_PLAYLIST:
-        if (pCurrentPlaylistSongCountHandler)
+        removePendingRequest(i);
+        return true;
+    }
+    return !asked;
+}
+
+/*
+ * Names in a getItemNames batch arrive in order, so if one turns up at
+ * offset after a gap, the ones from request.nextOffset up to it have gone
+ * missing. Asks for just those again, as a request of their own, so that
+ * the names after the gap can still be used. Returns false if there's no
+ * room to send or track it just now.
+ */
+bool AdvancedRemote::askAgainForMissing(const PendingRequest &request, unsigned long offset)
+{
+    if (pendingRequestCount == IPOD_SERIAL_MAX_PENDING_REQUESTS)
+    {
+        return false;
+    }
+
+    byte data[MAX_REQUEST_SIZE];
+    memcpy(data, request.data, request.length);
+    writeNumber(&data[4], request.nextOffset);
+    writeNumber(&data[8], offset - request.nextOffset);
+    if (!sendRequest(request.length, data))
+    {
+        return false;
+    }
+
+#if IPOD_SERIAL_LOG_LEVEL >= IPOD_SERIAL_LOG_INFO
+    debugNumber(PSTR("item names went missing, asking again from "), request.nextOffset);
+#endif
+    trackRequest(request.length, data);
+    return true;
+}
+
+void AdvancedRemote::trackRequest(size_t length, const byte *pData)
+{
+    PendingRequest &pending = pendingRequests[pendingRequestCount++];
+    pending.sentMillis = millis();
+    pending.nextOffset = (pData[2] == CMD_GET_ITEM_NAMES) ? endianConvert(&pData[4]) : 0;
+    pending.retriesLeft = requestRetries;
+    pending.length = length;
+    memcpy(pending.data, pData, length);
+}
+
+void AdvancedRemote::removePendingRequest(byte index)
+{
+    --pendingRequestCount;
+    memmove(&pendingRequests[index],
+            &pendingRequests[index + 1],
+            (pendingRequestCount - index) * sizeof(PendingRequest));
+}
+
+void AdvancedRemote::checkRequestTimeouts()
+{
+    const unsigned long now = millis();
+
+    byte i = 0;
+    while (i < pendingRequestCount)
+    {
+        PendingRequest &request = pendingRequests[i];
+        if ((now - request.sentMillis) < requestTimeoutMillis)
         {
-            pCurrentPlaylistSongCountHandler(endianConvert(pData));
+            ++i;
+            continue;
         }
-        break;
 
-#if defined(IPOD_SERIAL_DEBUG)
-    default:
-        if (pDebugPrint)
+        if (request.retriesLeft)
         {
-            pDebugPrint->print("unsupported response: ");
-            dumpReceive();
+            // ask again from the first name we haven't had yet, but keep
+            // what was first asked for so late answers to it still count as had
+            byte data[MAX_REQUEST_SIZE];
+            memcpy(data, request.data, request.length);
+            if (data[2] == CMD_GET_ITEM_NAMES)
+            {
+                const unsigned long end = endianConvert(&data[4]) + endianConvert(&data[8]);
+                writeNumber(&data[4], request.nextOffset);
+                writeNumber(&data[8], end - request.nextOffset);
+            }
+
+#if IPOD_SERIAL_LOG_LEVEL >= IPOD_SERIAL_LOG_INFO
+            log(PSTR("request timed out, retrying"));
+#endif
+            // if there's no room to send it right now we'll try again next time round
+            if (sendRequest(request.length, data))
+            {
+                --request.retriesLeft;
+                request.sentMillis = now;
+            }
+            ++i;
+            continue;
         }
-        break;
+
+        const byte command = request.data[2];
+        removePendingRequest(i);
+
+#if IPOD_SERIAL_LOG_LEVEL >= IPOD_SERIAL_LOG_ERROR
+        log(PSTR("request timed out, giving up"));
 #endif
+        if (pTimeoutHandler)
+        {
+            IPOD_SERIAL_PROFILED_HANDLER(pTimeoutHandler(command));
+        }
     }
 }
+#endif
+
+/*
+ * Checks the response is long enough to hold the given number
+ * of bytes of parameters after its mode and command bytes.
+ * Strings don't need checking, since they're always NUL-terminated.
+ */
+bool AdvancedRemote::hasParams(size_t length)
+{
+    return dataSize >= (3 + length);
+}
 
 /*
  * iPod is big endian and arduino is little endian,
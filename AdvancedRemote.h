@@ -27,8 +27,93 @@
 
 #include "iPodSerial.h"
 
-class AdvancedRemote : public iPodSerial
+// Request timeouts and retries (see setRequestTimeout). Keeping track of
+// the requests waiting for an answer takes 8 bytes of RAM plus 22 for each
+// of IPOD_SERIAL_MAX_PENDING_REQUESTS, 96 bytes in all by default, so
+// they're left out unless you define this as 1.
+#if !defined(IPOD_SERIAL_REQUEST_TIMEOUTS)
+#define IPOD_SERIAL_REQUEST_TIMEOUTS 0
+#endif
+
+// The number of requests that can be waiting for a response from the iPod
+// at once when request timeouts are turned on, and the number of commands
+// the latency histograms (below) can be timing at once.
+#if !defined(IPOD_SERIAL_MAX_PENDING_REQUESTS)
+#define IPOD_SERIAL_MAX_PENDING_REQUESTS 4
+#endif
+
+// Round-trip latency histograms for each Advanced Remote command (see
+// getLatencyCount() and friends). They take about 800 bytes of RAM, which
+// is too much for anything smaller than a Mega, so they're left out unless
+// you define this as 1.
+#if !defined(IPOD_SERIAL_LATENCY_HISTOGRAMS)
+#define IPOD_SERIAL_LATENCY_HISTOGRAMS 0
+#endif
+
+/*
+ * The responses AdvancedRemote understands, one per line. The handler
+ * slots and the table of response descriptors (kept in flash), which
+ * processData() looks opcodes up in, are generated from this list. Each line
+ * gives:
+ *   - the name of the response's handler slot
+ *   - its opcode (the command's, plus one, except for feedback)
+ *   - how its parameters are laid out, which decides how they're decoded
+ *     and the type of its handler
+ *   - the fewest parameter bytes it can have
+ * To add a response, add a line here, a LAYOUT_ for it if none of the
+ * existing ones fit, and a method for setting its handler.
+ */
+#define ADVANCED_REMOTE_RESPONSES(X) \
+    X(FEEDBACK,                    RESPONSE_FEEDBACK,                           LAYOUT_FEEDBACK,         3) \
+    X(IPOD_NAME,                   CMD_GET_IPOD_NAME + 1,                       LAYOUT_STRING,           0) \
+    X(ITEM_COUNT,                  CMD_GET_ITEM_COUNT + 1,                      LAYOUT_NUMBER,           4) \
+    X(ITEM_NAME,                   CMD_GET_ITEM_NAMES + 1,                      LAYOUT_NUMBER_AND_STRING, 4) \
+    X(TIME_AND_STATUS,             CMD_GET_TIME_AND_STATUS_INFO + 1,            LAYOUT_TIME_AND_STATUS,  9) \
+    X(PLAYLIST_POSITION,           CMD_GET_PLAYLIST_POSITION + 1,               LAYOUT_NUMBER,           4) \
+    X(TITLE,                       CMD_GET_TITLE + 1,                           LAYOUT_STRING,           0) \
+    X(ARTIST,                      CMD_GET_ARTIST + 1,                          LAYOUT_STRING,           0) \
+    X(ALBUM,                       CMD_GET_ALBUM + 1,                           LAYOUT_STRING,           0) \
+    X(POLLING,                     CMD_POLLING_MODE + 1,                        LAYOUT_POLLING,          5) \
+    X(SHUFFLE_MODE,                CMD_GET_SHUFFLE_MODE + 1,                    LAYOUT_SHUFFLE_MODE,     1) \
+    X(REPEAT_MODE,                 CMD_GET_REPEAT_MODE + 1,                     LAYOUT_REPEAT_MODE,      1) \
+    X(CURRENT_PLAYLIST_SONG_COUNT, CMD_GET_SONG_COUNT_IN_CURRENT_PLAYLIST + 1,  LAYOUT_NUMBER,           4)
+
+#define ADVANCED_REMOTE_HANDLER_SLOT(name, opcode, layout, minParams) HANDLER_##name,
+
+#if IPOD_SERIAL_LATENCY_HISTOGRAMS
+/*
+ * The commands that get a latency histogram each, in the order they're
+ * kept. Both the table of them (kept in flash) and the number of
+ * histograms are generated from this list.
+ */
+#define ADVANCED_REMOTE_TIMED_COMMANDS(X) \
+    X(CMD_GET_IPOD_NAME) \
+    X(CMD_SWITCH_TO_MAIN_LIBRARY_PLAYLIST) \
+    X(CMD_SWITCH_TO_ITEM) \
+    X(CMD_GET_ITEM_COUNT) \
+    X(CMD_GET_ITEM_NAMES) \
+    X(CMD_GET_TIME_AND_STATUS_INFO) \
+    X(CMD_GET_PLAYLIST_POSITION) \
+    X(CMD_GET_TITLE) \
+    X(CMD_GET_ARTIST) \
+    X(CMD_GET_ALBUM) \
+    X(CMD_POLLING_MODE) \
+    X(CMD_EXECUTE_SWITCH) \
+    X(CMD_PLAYBACK_CONTROL) \
+    X(CMD_GET_SHUFFLE_MODE) \
+    X(CMD_SET_SHUFFLE_MODE) \
+    X(CMD_GET_REPEAT_MODE) \
+    X(CMD_SET_REPEAT_MODE) \
+    X(CMD_GET_SONG_COUNT_IN_CURRENT_PLAYLIST) \
+    X(CMD_JUMP_TO_SONG_IN_CURRENT_PLAYLIST)
+
+#define ADVANCED_REMOTE_TIMED_SLOT(cmd) TIMED_##cmd,
+#endif
+
+class AdvancedRemote : public iPodSerialT<AdvancedRemote>
 {
+    friend class iPodSerialT<AdvancedRemote>;
+
 public: // enums
     enum ItemType
     {
@@ -130,27 +215,91 @@ public: // handler definitions
     typedef void ShuffleModeHandler_t(ShuffleMode mode);
     typedef void RepeatModeHandler_t(RepeatMode mode);
     typedef void CurrentPlaylistSongCountHandler_t(unsigned long count);
+#if IPOD_SERIAL_REQUEST_TIMEOUTS
+    typedef void TimeoutHandler_t(byte cmd);
+#endif
+
+    /*
+     * The string handlers can instead be given the string's length,
+     * taken from the frame, so there's no need to strlen() it. The
+     * string (which is still NUL-terminated) and length are only valid
+     * until the handler returns. complete is false if the string was cut
+     * short: either the iPod's own terminating NUL wasn't there, or the
+     * response was longer than IPOD_SERIAL_MAX_DATA_SIZE and only the start
+     * of it was kept.
+     */
+    typedef void iPodNameViewHandler_t(const char *ipodName, size_t length, bool complete);
+    typedef void ItemNameViewHandler_t(unsigned long offset, const char *itemName, size_t length, bool complete);
+    typedef void TitleViewHandler_t(const char *title, size_t length, bool complete);
+    typedef void ArtistViewHandler_t(const char *artist, size_t length, bool complete);
+    typedef void AlbumViewHandler_t(const char *album, size_t length, bool complete);
 
 
 public: // handler setting methods; you probably want to call these from init()
     void setFeedbackHandler(FeedbackHandler_t newHandler);
     void setiPodNameHandler(iPodNameHandler_t newHandler);
+    void setiPodNameHandler(iPodNameViewHandler_t newHandler);
     void setItemCountHandler(ItemCountHandler_t newHandler);
     void setItemNameHandler(ItemNameHandler_t newHandler);
+    void setItemNameHandler(ItemNameViewHandler_t newHandler);
     void setTimeAndStatusHandler(TimeAndStatusHandler_t newHandler);
     void setPlaylistPositionHandler(PlaylistPositionHandler_t newHandler);
     void setTitleHandler(TitleHandler_t newHandler);
+    void setTitleHandler(TitleViewHandler_t newHandler);
     void setArtistHandler(ArtistHandler_t newHandler);
+    void setArtistHandler(ArtistViewHandler_t newHandler);
     void setAlbumHandler(AlbumHandler_t newHandler);
+    void setAlbumHandler(AlbumViewHandler_t newHandler);
     void setPollingHandler(PollingHandler_t newHandler);
     void setShuffleModeHandler(ShuffleModeHandler_t newHandler);
     void setRepeatModeHandler(RepeatModeHandler_t newHandler);
     void setCurrentPlaylistSongCountHandler(CurrentPlaylistSongCountHandler_t newHandler);
+#if IPOD_SERIAL_REQUEST_TIMEOUTS
+    void setTimeoutHandler(TimeoutHandler_t newHandler);
+#endif
 
 
 public: // methods
     AdvancedRemote();
 
+    /**
+     * As iPodSerialT::loop(), but also checks for requests that the iPod
+     * hasn't answered in time (see setRequestTimeout).
+     */
+    void loop();
+
+#if IPOD_SERIAL_REQUEST_TIMEOUTS
+    /**
+     * Turns on tracking of requests sent to the iPod. Each request is
+     * remembered until its response or feedback comes back; if that
+     * doesn't happen within timeoutMillis it is sent again, up to retries
+     * times, after which it is given up on and the TimeoutHandler is
+     * called with its command (one of the CMD_ constants).
+     *
+     * For getItemNames the timeout applies to each name in turn, and each
+     * name is passed on once. Names that go missing are asked for again as
+     * soon as one after them arrives, as a request of their own, so they
+     * can turn up after the names that follow them.
+     *
+     * While tracking is on, at most IPOD_SERIAL_MAX_PENDING_REQUESTS
+     * requests can be waiting at once; further requests are dropped (the
+     * send method returns false) until some have been answered.
+     * A timeoutMillis of 0, the default, turns tracking off.
+     */
+    void setRequestTimeout(unsigned long timeoutMillis, byte retries);
+
+    /**
+     * Returns the number of tracked requests still waiting for the iPod.
+     */
+    byte getPendingRequestCount();
+#endif
+
+    /*
+     * The methods below that send a command to the iPod return true if it
+     * was sent, or false if it had to be dropped because the transmit queue
+     * (see iPodSerial::setTransmitQueue) was full.
+     */
+
     /**
      * Turn on Advanced Remote mode. This causes the iPod to
      * show a check mark and "OK to disconnect" on its display.
@@ -162,7 +311,7 @@ public: // methods
      *
      * You must call this before calling any of the getXXX methods.
      */
-    void enable();
+    bool enable();
 
     /**
      * disabled Advanced Remote mode.
@@ -171,19 +320,19 @@ public: // methods
      * "OK to disconnect", and let you control it through its
      * own interface again.
      */
-    void disable();
+    bool disable();
 
     /**
      * Get the name of the iPod.
      * The response will be sent to the iPodNameHandler, if one
      * has been registered (otherwise it will be ignored).
      */
-    void getiPodName();
+    bool getiPodName();
 
     /**
      * Switch to the Main Library playlist (playlist 0).
      */
-    void switchToMainLibraryPlaylist();
+    bool switchToMainLibraryPlaylist();
 
     /**
      * Switch to the item identified by the type and index given.
@@ -191,7 +340,7 @@ public: // methods
      * menu to the item specified. If you want to select the item
      * for playing you then need to call executeSwitch()
      */
-    void switchToItem(ItemType itemType, long index);
+    bool switchToItem(ItemType itemType, long index);
 
     /**
      * Get the total number of items of the specified type.
@@ -201,7 +350,7 @@ public: // methods
      * selected playlist (via switchToItem). The playlist doesn't
      * have to also have been executeSwitch()'d to however.
      */
-    void getItemCount(ItemType itemType);
+    bool getItemCount(ItemType itemType);
 
     /**
      * Get the names of a range of items.
@@ -210,14 +359,14 @@ public: // methods
      * selected playlist (via switchToItem). The playlist doesn't
      * have to also have been executeSwitch()'d to however.
      */
-    void getItemNames(ItemType itemType, unsigned long offset, unsigned long count);
+    bool getItemNames(ItemType itemType, unsigned long offset, unsigned long count);
 
      /**
      * Ask the iPod for time and playback status information.
      * The response will be sent to the TimeAndStatusHandler, if one
      * has been registered (otherwise it will be ignored).
      */
-    void getTimeAndStatusInfo();
+    bool getTimeAndStatusInfo();
 
     /**
      * Ask the iPod for the current position in the current playlist.
@@ -227,7 +376,7 @@ public: // methods
      * or via the iPod's controls - calling switchToItem for a playlist is
      * not enough.
      */
-    void getPlaylistPosition();
+    bool getPlaylistPosition();
 
     /**
      * ask the iPod for the title of a track.
@@ -237,7 +386,7 @@ public: // methods
      * selected playlist (via switchToItem). The playlist doesn't
      * have to also have been executeSwitch()'d to however.
      */
-    void getTitle(unsigned long index);
+    bool getTitle(unsigned long index);
 
     /**
      * ask the iPod for the artist for a track.
@@ -247,7 +396,7 @@ public: // methods
      * selected playlist (via switchToItem). The playlist doesn't
      * have to also have been executeSwitch()'d to however.
      */
-    void getArtist(unsigned long index);
+    bool getArtist(unsigned long index);
 
     /**
      * ask the iPod for the album for a track.
@@ -257,7 +406,7 @@ public: // methods
      * selected playlist (via switchToItem). The playlist doesn't
      * have to also have been executeSwitch()'d to however.
      */
-    void getAlbum(unsigned long index);
+    bool getAlbum(unsigned long index);
 
     /**
      * Start or stop polling mode.
@@ -266,7 +415,7 @@ public: // methods
      * These responses will be sent to the PollingHandler, if one
      * has been registered (otherwise they will be ignored).
      */
-    void setPollingMode(PollingMode newMode);
+    bool setPollingMode(PollingMode newMode);
 
     /**
      * Execute playlist-switch specified in last setItem call, and jump to specified number
@@ -275,36 +424,36 @@ public: // methods
      * and jumpToSongInCurrentPlaylist() will be in the context of this newly-switched-to
      * playlist.
      */
-    void executeSwitch(unsigned long index);
+    bool executeSwitch(unsigned long index);
 
     /**
      * Control playback (play/pause, etc)
      */
-    void controlPlayback(PlaybackControl command);
+    bool controlPlayback(PlaybackControl command);
 
     /**
      * Ask the iPod for the current shuffle mode.
      * The response will be sent to the ShuffleModeHandler, if one
      * has been registered (otherwise it will be ignored).
      */
-    void getShuffleMode();
+    bool getShuffleMode();
 
     /**
      * Set the shuffle mode.
      */
-    void setShuffleMode(ShuffleMode newMode);
+    bool setShuffleMode(ShuffleMode newMode);
 
     /**
      * Ask the iPod for the current repeat mode.
      * The response will be sent to the RepeatModeHandler, if one
      * has been registered (otherwise it will be ignored).
      */
-    void getRepeatMode();
+    bool getRepeatMode();
 
     /**
      * Set the repeat mode.
      */
-    void setRepeatMode(RepeatMode newMode);
+    bool setRepeatMode(RepeatMode newMode);
 
     /**
      * Get the count of songs in the current playlist.
@@ -314,7 +463,7 @@ public: // methods
      * or via the iPod's controls - calling switchToItem for a playlist is
      * not enough.
      */
-    void getSongCountInCurrentPlaylist();
+    bool getSongCountInCurrentPlaylist();
 
     /**
      * Jump to the specified song in the current playlist.
@@ -322,7 +471,30 @@ public: // methods
      * or via the iPod's controls - calling switchToItem for a playlist is
      * not enough.
      */
-    void jumpToSongInCurrentPlaylist(unsigned long index);
+    bool jumpToSongInCurrentPlaylist(unsigned long index);
+
+#if IPOD_SERIAL_LATENCY_HISTOGRAMS
+    /**
+     * How long each command takes, in microseconds, from being sent to its
+     * response or feedback arriving, for the CMD_* constants above. For
+     * getItemNames it's the time until the first name arrives. Percentiles
+     * (e.g. 50 or 99) come from a histogram with a bucket for each power of
+     * two, so they're only good to within a factor of two; the minimum and
+     * maximum are exact. Commands that haven't been timed give 0.
+     */
+    unsigned long getLatencyCount(byte cmd);
+    unsigned long getLatencyMinMicros(byte cmd);
+    unsigned long getLatencyPercentileMicros(byte cmd, byte percentile);
+    unsigned long getLatencyMaxMicros(byte cmd);
+
+    /**
+     * Prints a line for each command that has been timed, with its count,
+     * minimum, median, 99th percentile and maximum.
+     */
+    void printLatencyHistograms(Print &out);
+
+    void resetLatencyHistograms();
+#endif
 
     /**
      * returns true if advanced mode is enabled, false otherwise.
@@ -330,28 +502,144 @@ public: // methods
      */
     bool isCurrentlyEnabled();
 
+private: // enums
+    // how a response's parameters are laid out (see ADVANCED_REMOTE_RESPONSES)
+    enum Layout
+    {
+        LAYOUT_FEEDBACK = 0,      // result, then the command (as FeedbackHandler_t)
+        LAYOUT_STRING,            // a NUL-terminated string (as TitleHandler_t or TitleViewHandler_t)
+        LAYOUT_NUMBER,            // a 4-byte number (as ItemCountHandler_t)
+        LAYOUT_NUMBER_AND_STRING, // a 4-byte number, then a string (as ItemNameHandler_t or ItemNameViewHandler_t)
+        LAYOUT_TIME_AND_STATUS,   // as TimeAndStatusHandler_t
+        LAYOUT_POLLING,           // as PollingHandler_t
+        LAYOUT_SHUFFLE_MODE,      // as ShuffleModeHandler_t
+        LAYOUT_REPEAT_MODE        // as RepeatModeHandler_t
+    };
+
+    enum HandlerSlot
+    {
+        ADVANCED_REMOTE_RESPONSES(ADVANCED_REMOTE_HANDLER_SLOT)
+        HANDLER_COUNT
+    };
+
+private: // handler definitions
+    // what the handlers are kept as; each is cast back to its
+    // real type, according to its layout, before it's called
+    typedef void GenericHandler_t();
+
 private: // attributes
     static const byte RESPONSE_BAD = 0x00;
     static const byte RESPONSE_FEEDBACK = 0x01;
 
-    FeedbackHandler_t *pFeedbackHandler;
-    iPodNameHandler_t *piPodNameHandler;
-    ItemCountHandler_t *pItemCountHandler;
-    ItemNameHandler_t *pItemNameHandler;
-    TimeAndStatusHandler_t *pTimeAndStatusHandler;
-    PlaylistPositionHandler_t *pPlaylistPositionHandler;
-    TitleHandler_t *pTitleHandler;
-    ArtistHandler_t *pArtistHandler;
-    AlbumHandler_t *pAlbumHandler;
-    PollingHandler_t *pPollingHandler;
-    ShuffleModeHandler_t *pShuffleModeHandler;
-    RepeatModeHandler_t *pRepeatModeHandler;
-    CurrentPlaylistSongCountHandler_t *pCurrentPlaylistSongCountHandler;
+    struct ResponseDescriptor
+    {
+        byte layout;
+        byte minParams;
+    };
+
+    // in flash, in HandlerSlot order
+    static const ResponseDescriptor RESPONSES[HANDLER_COUNT];
+
+    // one more than the highest response opcode
+    static const byte RESPONSE_OPCODE_LIMIT = 0x38;
+
+    // in flash, indexed by opcode: the response's HandlerSlot, or
+    // HANDLER_COUNT for an opcode that isn't a response we understand
+    static const byte SLOTS_BY_OPCODE[RESPONSE_OPCODE_LIMIT];
+
+    GenericHandler_t *pHandlers[HANDLER_COUNT];
+    // a bit per HandlerSlot, set if its handler wants the string's length
+    unsigned int stringViewSlots;
+    static_assert(HANDLER_COUNT <= 8 * sizeof(unsigned int),
+                  "stringViewSlots needs a bit per handler slot; widen it");
 
     bool currentlyEnabled;
 
+#if IPOD_SERIAL_REQUEST_TIMEOUTS
+    TimeoutHandler_t *pTimeoutHandler;
+
+    // the longest Advanced Remote command we send
+    static const size_t MAX_REQUEST_SIZE = 1 + 1 + 1 + 1 + (2 * 4);
+
+    struct PendingRequest
+    {
+        unsigned long sentMillis;
+        // for getItemNames, the first name that hasn't arrived yet
+        unsigned long nextOffset;
+        byte retriesLeft;
+        byte length;
+        byte data[MAX_REQUEST_SIZE];
+    };
+
+    // oldest first, so that when the same command is pending more than
+    // once a response is matched to the request it's actually for
+    PendingRequest pendingRequests[IPOD_SERIAL_MAX_PENDING_REQUESTS];
+    byte pendingRequestCount;
+    unsigned long requestTimeoutMillis;
+    byte requestRetries;
+#endif
+
+#if IPOD_SERIAL_LATENCY_HISTOGRAMS
+    enum TimedCommand
+    {
+        ADVANCED_REMOTE_TIMED_COMMANDS(ADVANCED_REMOTE_TIMED_SLOT)
+        TIMED_COMMAND_COUNT
+    };
+
+    // in flash, in TimedCommand order
+    static const byte TIMED_COMMANDS[TIMED_COMMAND_COUNT];
+    static const byte LATENCY_BUCKETS = 16;
+    // bucket 0 is everything under 2^LATENCY_SHIFT us, and each one after
+    // that is twice as wide as the one before
+    static const byte LATENCY_SHIFT = 9;
+
+    struct LatencyHistogram
+    {
+        unsigned int counts[LATENCY_BUCKETS];
+        unsigned long minMicros;
+        unsigned long maxMicros;
+    };
+
+    struct CommandInFlight
+    {
+        byte cmd;
+        unsigned long sentMicros;
+    };
+
+    LatencyHistogram latencyHistograms[TIMED_COMMAND_COUNT];
+    // oldest first, like pendingRequests
+    CommandInFlight commandsInFlight[IPOD_SERIAL_MAX_PENDING_REQUESTS];
+    byte commandsInFlightCount;
+#endif
+
 private: // methods
-    virtual void processData();
+    void processData();
+    bool wantsFrame();
+    bool wantsFrameTruncated();
+#if IPOD_SERIAL_REQUEST_TIMEOUTS || IPOD_SERIAL_LATENCY_HISTOGRAMS
+    bool isAwaited(byte opcode);
+#endif
+    static bool slotFor(byte opcode, HandlerSlot &slot);
+    static constexpr byte slotOf(byte opcode);
+    void setHandler(HandlerSlot slot, GenericHandler_t *pHandler, bool stringView = false);
+    void callHandler(HandlerSlot slot, const byte *pData);
+    bool sendCommandWithLength(size_t length, const byte *pData);
+    bool sendRequest(size_t length, const byte *pData);
+#if IPOD_SERIAL_REQUEST_TIMEOUTS
+    bool requestAnswered(byte command, bool feedback);
+    bool askAgainForMissing(const PendingRequest &request, unsigned long offset);
+    void trackRequest(size_t length, const byte *pData);
+    void removePendingRequest(byte index);
+    void checkRequestTimeouts();
+#endif
+    CommandPriority priorityOf(size_t length, const byte *pData);
+    bool isWaiting(byte cmd);
+#if IPOD_SERIAL_LATENCY_HISTOGRAMS
+    static int timedCommandIndex(byte cmd);
+    void commandSent(byte cmd);
+    void commandAnswered(byte cmd);
+#endif
+    bool hasParams(size_t length);
     static unsigned long endianConvert(const byte *p);
 };
 
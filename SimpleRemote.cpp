@@ -24,222 +24,164 @@
  ******************************************************************************/
 #include "SimpleRemote.h"
 
-void SimpleRemote::sendButtonReleased()
-{
-    static const byte button_released[] = {SIMPLE_REMOTE_MODE, 0x00, 0x00};
+// The checksum covers the length byte and the data; the zero mask bytes
+// that aren't sent don't change it.
+#define SIMPLE_REMOTE_CHECKSUM(maskLength, mask0, mask1, mask2, mask3) \
+    ((byte) ((0x100 - ((2 + (maskLength)) + SIMPLE_REMOTE_MODE + 0x00 + (mask0) + (mask1) + (mask2) + (mask3))) & 0xFF))
 
-#if defined(IPOD_SERIAL_DEBUG)
-    log("Sending button_released");
-#endif
-    sendCommandWithLength(ARRAY_LEN(button_released), button_released);
-}
+// what goes after the command byte: the mask bytes that are sent, the
+// checksum, then padding to fill the slot
+#define SIMPLE_REMOTE_FRAME_BYTE(i, maskLength, mask, checksum) \
+    ((byte) (((i) < (maskLength)) ? (mask) : (((i) == (maskLength)) ? (checksum) : 0x00)))
 
-void SimpleRemote::sendPlay()
+#define SIMPLE_REMOTE_FRAME(name, maskLength, mask0, mask1, mask2, mask3) \
+    { \
+        AAPFrameParser::HEADER1, \
+        AAPFrameParser::HEADER2, \
+        2 + (maskLength), \
+        SIMPLE_REMOTE_MODE, \
+        0x00, \
+        SIMPLE_REMOTE_FRAME_BYTE(0, maskLength, mask0, SIMPLE_REMOTE_CHECKSUM(maskLength, mask0, mask1, mask2, mask3)), \
+        SIMPLE_REMOTE_FRAME_BYTE(1, maskLength, mask1, SIMPLE_REMOTE_CHECKSUM(maskLength, mask0, mask1, mask2, mask3)), \
+        SIMPLE_REMOTE_FRAME_BYTE(2, maskLength, mask2, SIMPLE_REMOTE_CHECKSUM(maskLength, mask0, mask1, mask2, mask3)), \
+        SIMPLE_REMOTE_FRAME_BYTE(3, maskLength, mask3, SIMPLE_REMOTE_CHECKSUM(maskLength, mask0, mask1, mask2, mask3)), \
+        SIMPLE_REMOTE_FRAME_BYTE(4, maskLength, 0x00, SIMPLE_REMOTE_CHECKSUM(maskLength, mask0, mask1, mask2, mask3)) \
+    },
+
+const byte SimpleRemote::FRAMES[BUTTON_COUNT][FRAME_SIZE] PROGMEM =
 {
-    static const byte play[] = {SIMPLE_REMOTE_MODE, 0x00, 0x01};
+    SIMPLE_REMOTE_BUTTONS(SIMPLE_REMOTE_FRAME)
+};
 
-#if defined(IPOD_SERIAL_DEBUG)
-    log("Sending play");
-#endif
-    sendCommandWithLength(ARRAY_LEN(play), play);
+bool SimpleRemote::wantsFrame()
+{
+    // the Simple Remote doesn't get answers
+    return false;
 }
 
-void SimpleRemote::sendVolPlus()
+bool SimpleRemote::sendButton(Button button)
 {
-    static const byte vol_plus[] = {SIMPLE_REMOTE_MODE, 0x00, 0x02};
+    const byte *pFrame = FRAMES[button];
+    // the length byte counts the mode and command byte as well as the mask,
+    // and the frame has a header before it and a checksum after
+    const size_t frameLength = 2 + 1 + pgm_read_byte(&pFrame[2]) + 1;
 
-#if defined(IPOD_SERIAL_DEBUG)
-    log("Sending vol_plus");
+#if IPOD_SERIAL_LOG_LEVEL >= IPOD_SERIAL_LOG_INFO
+    byte mask[4];
+    memcpy_P(mask, &pFrame[5], frameLength - 6);
+    logBytes(PSTR("Sending buttons:"), mask, frameLength - 6);
 #endif
-    sendCommandWithLength(ARRAY_LEN(vol_plus), vol_plus);
+
+    // the buttons are all things the user is waiting on
+    return sendFrameFromFlash(frameLength, pFrame, PRIORITY_INTERACTIVE);
 }
 
-void SimpleRemote::sendVolMinus()
+bool SimpleRemote::sendButtonReleased()
 {
-    static const byte vol_minus[] = {SIMPLE_REMOTE_MODE, 0x00, 0x04};
-
-#if defined(IPOD_SERIAL_DEBUG)
-    log("Sending vol_minus");
-#endif
-    sendCommandWithLength(ARRAY_LEN(vol_minus), vol_minus);
+    return sendButton(BUTTON_RELEASED);
 }
 
-void SimpleRemote::sendSkipForward()
+bool SimpleRemote::sendPlay()
 {
-    static const byte skip_forward[] = {SIMPLE_REMOTE_MODE, 0x00, 0x08};
-
-#if defined(IPOD_SERIAL_DEBUG)
-    log("Sending skip_forward");
-#endif
-    sendCommandWithLength(ARRAY_LEN(skip_forward), skip_forward);
+    return sendButton(BUTTON_PLAY);
 }
 
-void SimpleRemote::sendSkipBackward()
+bool SimpleRemote::sendVolPlus()
 {
-    static const byte skip_backward[] = {SIMPLE_REMOTE_MODE, 0x00, 0x10};
-
-#if defined(IPOD_SERIAL_DEBUG)
-    log("Sending skip_backward");
-#endif
-    sendCommandWithLength(ARRAY_LEN(skip_backward), skip_backward);
+    return sendButton(BUTTON_VOL_PLUS);
 }
 
-void SimpleRemote::sendNextAlbum()
+bool SimpleRemote::sendVolMinus()
 {
-    static const byte next_album[] = {SIMPLE_REMOTE_MODE, 0x00, 0x20};
-
-#if defined(IPOD_SERIAL_DEBUG)
-    log("Sending next_album");
-#endif
-    sendCommandWithLength(ARRAY_LEN(next_album), next_album);
+    return sendButton(BUTTON_VOL_MINUS);
 }
 
-void SimpleRemote::sendPreviousAlbum()
+bool SimpleRemote::sendSkipForward()
 {
-    static const byte previous_album[] = {SIMPLE_REMOTE_MODE, 0x00, 0x40};
-
-#if defined(IPOD_SERIAL_DEBUG)
-    log("Sending previous_album");
-#endif
-    sendCommandWithLength(ARRAY_LEN(previous_album), previous_album);
+    return sendButton(BUTTON_SKIP_FORWARD);
 }
 
-void SimpleRemote::sendStop()
+bool SimpleRemote::sendSkipBackward()
 {
-    static const byte stop[] = {SIMPLE_REMOTE_MODE, 0x00, 0x80};
-
-#if defined(IPOD_SERIAL_DEBUG)
-    log("Sending stop");
-#endif
-    sendCommandWithLength(ARRAY_LEN(stop), stop);
+    return sendButton(BUTTON_SKIP_BACKWARD);
 }
 
-void SimpleRemote::sendJustPlay()
+bool SimpleRemote::sendNextAlbum()
 {
-    static const byte just_play[] = {SIMPLE_REMOTE_MODE, 0x00, 0x00, 0x01};
-
-#if defined(IPOD_SERIAL_DEBUG)
-    log("Sending just_play");
-#endif
-    sendCommandWithLength(ARRAY_LEN(just_play), just_play);
+    return sendButton(BUTTON_NEXT_ALBUM);
 }
 
-void SimpleRemote::sendJustPause()
+bool SimpleRemote::sendPreviousAlbum()
 {
-    static const byte just_pause[] = {SIMPLE_REMOTE_MODE, 0x00, 0x00, 0x02};
-
-#if defined(IPOD_SERIAL_DEBUG)
-    log("Sending just_pause");
-#endif
-    sendCommandWithLength(ARRAY_LEN(just_pause), just_pause);
+    return sendButton(BUTTON_PREVIOUS_ALBUM);
 }
 
-void SimpleRemote::sendToggleMute()
+bool SimpleRemote::sendStop()
 {
-    static const byte toggle_mute[] = {SIMPLE_REMOTE_MODE, 0x00, 0x00, 0x04};
-
-#if defined(IPOD_SERIAL_DEBUG)
-    log("Sending toggle_mute");
-#endif
-    sendCommandWithLength(ARRAY_LEN(toggle_mute), toggle_mute);
+    return sendButton(BUTTON_STOP);
 }
 
-void SimpleRemote::sendNextPlaylist()
+bool SimpleRemote::sendJustPlay()
 {
-    static const byte next_playlist[] = {SIMPLE_REMOTE_MODE, 0x00, 0x00, 0x20};
-
-#if defined(IPOD_SERIAL_DEBUG)
-    log("Sending next_playlist");
-#endif
-    sendCommandWithLength(ARRAY_LEN(next_playlist), next_playlist);
+    return sendButton(BUTTON_JUST_PLAY);
 }
 
-void SimpleRemote::sendPreviousPlaylist()
+bool SimpleRemote::sendJustPause()
 {
-    static const byte previous_playlist[] = {SIMPLE_REMOTE_MODE, 0x00, 0x00, 0x40};
-
-#if defined(IPOD_SERIAL_DEBUG)
-    log("Sending previous_playlist");
-#endif
-    sendCommandWithLength(ARRAY_LEN(previous_playlist), previous_playlist);
+    return sendButton(BUTTON_JUST_PAUSE);
 }
 
-void SimpleRemote::sendToggleShuffle()
+bool SimpleRemote::sendToggleMute()
 {
-    static const byte toggle_shuffle[] = {SIMPLE_REMOTE_MODE, 0x00, 0x00, 0x80};
-
-#if defined(IPOD_SERIAL_DEBUG)
-    log("Sending toggle_shuffle");
-#endif
-    sendCommandWithLength(ARRAY_LEN(toggle_shuffle), toggle_shuffle);
+    return sendButton(BUTTON_TOGGLE_MUTE);
 }
 
-void SimpleRemote::sendToggleRepeat()
+bool SimpleRemote::sendNextPlaylist()
 {
-    static const byte toggle_repeat[] = {SIMPLE_REMOTE_MODE, 0x00, 0x00, 0x00, 0x01};
-
-#if defined(IPOD_SERIAL_DEBUG)
-    log("Sending toggle_repeat");
-#endif
-    sendCommandWithLength(ARRAY_LEN(toggle_repeat), toggle_repeat);
+    return sendButton(BUTTON_NEXT_PLAYLIST);
 }
 
-void SimpleRemote::sendiPodOff()
+bool SimpleRemote::sendPreviousPlaylist()
 {
-    static const byte ipod_off[] = {SIMPLE_REMOTE_MODE, 0x00, 0x00, 0x00, 0x04};
-
-#if defined(IPOD_SERIAL_DEBUG)
-    log("Sending ipod_off");
-#endif
-    sendCommandWithLength(ARRAY_LEN(ipod_off), ipod_off);
+    return sendButton(BUTTON_PREVIOUS_PLAYLIST);
 }
 
-void SimpleRemote::sendiPodOn()
+bool SimpleRemote::sendToggleShuffle()
 {
-    static const byte ipod_on[] = {SIMPLE_REMOTE_MODE, 0x00, 0x00, 0x00, 0x08};
-
-#if defined(IPOD_SERIAL_DEBUG)
-    log("Sending ipod_on");
-#endif
-    sendCommandWithLength(ARRAY_LEN(ipod_on), ipod_on);
+    return sendButton(BUTTON_TOGGLE_SHUFFLE);
 }
 
-void SimpleRemote::sendMenuButton()
+bool SimpleRemote::sendToggleRepeat()
 {
-    static const byte menu_button[] = {SIMPLE_REMOTE_MODE, 0x00, 0x00, 0x00, 0x40};
-
-#if defined(IPOD_SERIAL_DEBUG)
-    log("Sending menu_button");
-#endif
-    sendCommandWithLength(ARRAY_LEN(menu_button), menu_button);
+    return sendButton(BUTTON_TOGGLE_REPEAT);
 }
 
-void SimpleRemote::sendOkSelectButton()
+bool SimpleRemote::sendiPodOff()
 {
-    static const byte ok_select_button[] = {SIMPLE_REMOTE_MODE, 0x00, 0x00, 0x00, 0x80};
+    return sendButton(BUTTON_IPOD_OFF);
+}
 
-#if defined(IPOD_SERIAL_DEBUG)
-    log("Sending ok_select_button");
-#endif
-    sendCommandWithLength(ARRAY_LEN(ok_select_button), ok_select_button);
+bool SimpleRemote::sendiPodOn()
+{
+    return sendButton(BUTTON_IPOD_ON);
 }
 
-void SimpleRemote::sendScrollUp()
+bool SimpleRemote::sendMenuButton()
 {
-    static const byte scroll_up[] = {SIMPLE_REMOTE_MODE, 0x00, 0x00, 0x00, 0x00, 0x01};
+    return sendButton(BUTTON_MENU);
+}
 
-#if defined(IPOD_SERIAL_DEBUG)
-    log("Sending scroll_up");
-#endif
-    sendCommandWithLength(ARRAY_LEN(scroll_up), scroll_up);
+bool SimpleRemote::sendOkSelectButton()
+{
+    return sendButton(BUTTON_OK_SELECT);
 }
 
-void SimpleRemote::sendScrollDown()
+bool SimpleRemote::sendScrollUp()
 {
-    static const byte scroll_down[] = {SIMPLE_REMOTE_MODE, 0x00, 0x00, 0x00, 0x00, 0x02};
+    return sendButton(BUTTON_SCROLL_UP);
+}
 
-#if defined(IPOD_SERIAL_DEBUG)
-    log("Sending scroll_down");
-#endif
-    sendCommandWithLength(ARRAY_LEN(scroll_down), scroll_down);
+bool SimpleRemote::sendScrollDown()
+{
+    return sendButton(BUTTON_SCROLL_DOWN);
 }
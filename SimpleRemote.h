@@ -27,11 +27,50 @@
 
 #include "iPodSerial.h"
 
+/*
+ * Every Simple Remote command, as its name and the button mask that goes
+ * after the mode and 0x00 command byte: the number of mask bytes sent
+ * (trailing zero bytes are left off) and the mask bytes themselves. The
+ * complete frames in SimpleRemote::FRAMES are worked out from this list
+ * when the library is compiled.
+ */
+#define SIMPLE_REMOTE_BUTTONS(X) \
+    X(RELEASED,          1, 0x00, 0x00, 0x00, 0x00) \
+    X(PLAY,              1, 0x01, 0x00, 0x00, 0x00) \
+    X(VOL_PLUS,          1, 0x02, 0x00, 0x00, 0x00) \
+    X(VOL_MINUS,         1, 0x04, 0x00, 0x00, 0x00) \
+    X(SKIP_FORWARD,      1, 0x08, 0x00, 0x00, 0x00) \
+    X(SKIP_BACKWARD,     1, 0x10, 0x00, 0x00, 0x00) \
+    X(NEXT_ALBUM,        1, 0x20, 0x00, 0x00, 0x00) \
+    X(PREVIOUS_ALBUM,    1, 0x40, 0x00, 0x00, 0x00) \
+    X(STOP,              1, 0x80, 0x00, 0x00, 0x00) \
+    X(JUST_PLAY,         2, 0x00, 0x01, 0x00, 0x00) \
+    X(JUST_PAUSE,        2, 0x00, 0x02, 0x00, 0x00) \
+    X(TOGGLE_MUTE,       2, 0x00, 0x04, 0x00, 0x00) \
+    X(NEXT_PLAYLIST,     2, 0x00, 0x20, 0x00, 0x00) \
+    X(PREVIOUS_PLAYLIST, 2, 0x00, 0x40, 0x00, 0x00) \
+    X(TOGGLE_SHUFFLE,    2, 0x00, 0x80, 0x00, 0x00) \
+    X(TOGGLE_REPEAT,     3, 0x00, 0x00, 0x01, 0x00) \
+    X(IPOD_OFF,          3, 0x00, 0x00, 0x04, 0x00) \
+    X(IPOD_ON,           3, 0x00, 0x00, 0x08, 0x00) \
+    X(MENU,              3, 0x00, 0x00, 0x40, 0x00) \
+    X(OK_SELECT,         3, 0x00, 0x00, 0x80, 0x00) \
+    X(SCROLL_UP,         4, 0x00, 0x00, 0x00, 0x01) \
+    X(SCROLL_DOWN,       4, 0x00, 0x00, 0x00, 0x02)
+
+#define SIMPLE_REMOTE_BUTTON_ID(name, maskLength, mask0, mask1, mask2, mask3) BUTTON_##name,
+
 /**
  * Issue Simple Remote (AAP Mode 2) commands.
+ *
+ * Each method returns true if the command was sent, or false if it had to
+ * be dropped because the transmit queue (see iPodSerial::setTransmitQueue)
+ * was full.
  */
-class SimpleRemote : public iPodSerial
+class SimpleRemote : public iPodSerialT<SimpleRemote>
 {
+    friend class iPodSerialT<SimpleRemote>;
+
 public:
     /**
      * Send this command when the user lets go of a button.
@@ -43,29 +82,45 @@ public:
      * is significant - it can trigger press-and-hold behaviour
      * and so on.
      */
-    void sendButtonReleased();
+    bool sendButtonReleased();
+
+    bool sendPlay();
+    bool sendVolPlus();
+    bool sendVolMinus();
+    bool sendSkipForward();
+    bool sendSkipBackward();
+    bool sendNextAlbum();
+    bool sendPreviousAlbum();
+    bool sendStop();
+    bool sendJustPlay();
+    bool sendJustPause();
+    bool sendToggleMute();
+    bool sendNextPlaylist();
+    bool sendPreviousPlaylist();
+    bool sendToggleShuffle();
+    bool sendToggleRepeat();
+    bool sendiPodOff();
+    bool sendiPodOn();
+    bool sendMenuButton();
+    bool sendOkSelectButton();
+    bool sendScrollUp();
+    bool sendScrollDown();
+
+private: // enums
+    enum Button
+    {
+        SIMPLE_REMOTE_BUTTONS(SIMPLE_REMOTE_BUTTON_ID)
+        BUTTON_COUNT
+    };
+
+private: // attributes
+    // header, length, mode, command byte, up to 4 mask bytes and checksum
+    static const size_t FRAME_SIZE = 2 + 1 + 1 + 1 + 4 + 1;
+    static const byte FRAMES[BUTTON_COUNT][FRAME_SIZE];
 
-    void sendPlay();
-    void sendVolPlus();
-    void sendVolMinus();
-    void sendSkipForward();
-    void sendSkipBackward();
-    void sendNextAlbum();
-    void sendPreviousAlbum();
-    void sendStop();
-    void sendJustPlay();
-    void sendJustPause();
-    void sendToggleMute();
-    void sendNextPlaylist();
-    void sendPreviousPlaylist();
-    void sendToggleShuffle();
-    void sendToggleRepeat();
-    void sendiPodOff();
-    void sendiPodOn();
-    void sendMenuButton();
-    void sendOkSelectButton();
-    void sendScrollUp();
-    void sendScrollDown();
+private: // methods
+    bool sendButton(Button button);
+    bool wantsFrame();
 };
 
 #endif // SIMPLE_REMOTE
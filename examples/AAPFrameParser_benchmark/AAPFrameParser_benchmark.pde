@@ -0,0 +1,171 @@
+// Microbenchmark of the cost of receiving a frame, comparing the original
+// receive path (checksum summed over the whole buffer once the frame is
+// complete, then the whole 128-byte buffer cleared with memset) with
+// AAPFrameParser (checksum kept up to date as each byte arrives, and only
+// a single terminating NUL written).
+//
+// Cycles are counted with Timer1, so this is for AVR boards only.
+// Results are printed to Serial at 115200 baud. No iPod is needed.
+
+#include <AAPFrameParser.h>
+
+#if !defined(__AVR__)
+#error "This example uses Timer1 to count cycles, so needs an AVR board"
+#endif
+
+const byte FRAME_SIZES[] = {4, 16, 64, 127};
+const unsigned int ITERATIONS = 100;
+
+byte frame[3 + 127 + 1];
+byte buffer[128 + 1];
+
+//
+// a copy of the receive path as it was before AAPFrameParser
+//
+struct OldReceiver
+{
+  enum ReceiveState
+  {
+    WAITING_FOR_HEADER1 = 0,
+    WAITING_FOR_HEADER2,
+    WAITING_FOR_LENGTH,
+    WAITING_FOR_DATA,
+    WAITING_FOR_CHECKSUM
+  };
+
+  ReceiveState receiveState;
+  byte dataSize;
+  byte dataBuffer[128];
+  byte *pData;
+
+  OldReceiver() : receiveState(WAITING_FOR_HEADER1), dataSize(0), pData(0) {}
+
+  bool validChecksum(byte actual)
+  {
+    int expected = dataSize;
+    for (int i = 0; i < dataSize; ++i)
+    {
+      expected += dataBuffer[i];
+    }
+    expected = (0x100 - expected) & 0xFF;
+    return expected == actual;
+  }
+
+  bool feed(byte b)
+  {
+    bool ready = false;
+    switch (receiveState)
+    {
+    case WAITING_FOR_HEADER1:
+      if (b == 0xFF) receiveState = WAITING_FOR_HEADER2;
+      break;
+    case WAITING_FOR_HEADER2:
+      if (b == 0x55) receiveState = WAITING_FOR_LENGTH;
+      break;
+    case WAITING_FOR_LENGTH:
+      dataSize = b;
+      pData = dataBuffer;
+      receiveState = WAITING_FOR_DATA;
+      break;
+    case WAITING_FOR_DATA:
+      *pData++ = b;
+      if ((pData - dataBuffer) == dataSize) receiveState = WAITING_FOR_CHECKSUM;
+      break;
+    case WAITING_FOR_CHECKSUM:
+      ready = validChecksum(b);
+      receiveState = WAITING_FOR_HEADER1;
+      memset(dataBuffer, 0, sizeof(dataBuffer));
+      break;
+    }
+    return ready;
+  }
+};
+
+OldReceiver oldReceiver;
+AAPFrameParser parser(buffer, sizeof(buffer));
+
+size_t buildFrame(byte dataSize)
+{
+  size_t i = 0;
+  frame[i++] = 0xFF;
+  frame[i++] = 0x55;
+  frame[i++] = dataSize;
+  byte checksum = dataSize;
+  for (byte d = 0; d < dataSize; ++d)
+  {
+    frame[i] = 'a' + (d % 26);
+    checksum += frame[i++];
+  }
+  frame[i++] = (0x100 - checksum) & 0xFF;
+  return i;
+}
+
+void startCycleCount()
+{
+  TCCR1A = 0;
+  TCCR1B = _BV(CS10); // no prescaling: one count per cycle
+  TCNT1 = 0;
+}
+
+unsigned int stopCycleCount()
+{
+  const unsigned int cycles = TCNT1;
+  TCCR1B = 0;
+  return cycles;
+}
+
+unsigned long timeOld(size_t frameLength)
+{
+  unsigned long total = 0;
+  for (unsigned int n = 0; n < ITERATIONS; ++n)
+  {
+    startCycleCount();
+    for (size_t i = 0; i < frameLength; ++i)
+    {
+      oldReceiver.feed(frame[i]);
+    }
+    total += stopCycleCount();
+  }
+  return total / ITERATIONS;
+}
+
+unsigned long timeNew(size_t frameLength)
+{
+  unsigned long total = 0;
+  for (unsigned int n = 0; n < ITERATIONS; ++n)
+  {
+    startCycleCount();
+    for (size_t i = 0; i < frameLength; ++i)
+    {
+      parser.feed(&frame[i], 1);
+    }
+    total += stopCycleCount();
+  }
+  return total / ITERATIONS;
+}
+
+void setup()
+{
+  Serial.begin(115200);
+  Serial.println("data bytes, old cycles/frame, new cycles/frame");
+
+  for (byte s = 0; s < sizeof(FRAME_SIZES); ++s)
+  {
+    const size_t frameLength = buildFrame(FRAME_SIZES[s]);
+
+    noInterrupts();
+    const unsigned long oldCycles = timeOld(frameLength);
+    const unsigned long newCycles = timeNew(frameLength);
+    interrupts();
+
+    Serial.print(FRAME_SIZES[s], DEC);
+    Serial.print(", ");
+    Serial.print(oldCycles, DEC);
+    Serial.print(", ");
+    Serial.println(newCycles, DEC);
+  }
+}
+
+void loop()
+{
+}
@@ -0,0 +1,148 @@
+// Benchmark of how well the library keeps up with a burst of responses
+// from the iPod (a getItemNames for every song) when the sketch only gets
+// round to calling loop() every LOOP_PERIOD_MS milliseconds, e.g. because
+// it's also busy driving a display.
+//
+// Every second it prints how many messages were parsed per call to
+// AdvancedRemote::loop() and how many times the iPod serial port's
+// receive buffer was found full (which means bytes were probably dropped).
+//
+// Change LOOP_PERIOD_MS and RECEIVE_BUDGET_BYTES to see how they interact.
+// A RECEIVE_BUDGET_BYTES of 1 gives the old one-byte-per-loop behaviour;
+// 0 means read everything that's waiting.
+//
+// If your iPod ends up stuck with the "OK to disconnect" message on its display,
+// reset the Arduino or the iPod.
+
+#include <AdvancedRemote.h>
+#include <Bounce.h>
+
+// This sketch needs to be adapted (change serial port config in setup())
+// to be used on a non-Mega, so check the board here so people notice.
+#if !defined(__AVR_ATmega1280__)
+#error "This example is for the Mega, because it uses Serial3 for the iPod and Serial for the results"
+#endif
+
+#if !defined(SERIAL_RX_BUFFER_SIZE)
+#define SERIAL_RX_BUFFER_SIZE 64
+#endif
+
+const byte BUTTON_PIN = 22;
+const unsigned long DEBOUNCE_MS = 50;
+
+const unsigned long LOOP_PERIOD_MS = 20;
+const unsigned int RECEIVE_BUDGET_BYTES = 0;
+const unsigned long REPORT_PERIOD_MS = 1000;
+
+Bounce button(BUTTON_PIN, DEBOUNCE_MS);
+AdvancedRemote advancedRemote;
+
+unsigned long loops = 0;
+unsigned long frames = 0;
+byte maxFramesPerLoop = 0;
+unsigned long overruns = 0;
+unsigned long names = 0;
+unsigned long lastReportMs = 0;
+
+void itemCountHandler(unsigned long count)
+{
+  Serial.print("Song count: ");
+  Serial.println(count);
+
+  advancedRemote.getItemNames(AdvancedRemote::ITEM_SONG, 0, count);
+}
+
+void itemNameHandler(unsigned long offset, const char *name)
+{
+  ++names;
+}
+
+void report()
+{
+  Serial.print("loops=");
+  Serial.print(loops);
+  Serial.print(" frames=");
+  Serial.print(frames);
+  Serial.print(" frames/loop=");
+  Serial.print(loops ? ((float) frames / loops) : 0.0);
+  Serial.print(" max frames/loop=");
+  Serial.print(maxFramesPerLoop, DEC);
+  Serial.print(" overruns=");
+  Serial.print(overruns);
+  Serial.print(" names=");
+  Serial.println(names);
+
+  loops = 0;
+  frames = 0;
+  maxFramesPerLoop = 0;
+  overruns = 0;
+}
+
+void setup()
+{
+  pinMode(BUTTON_PIN, INPUT);
+
+  // enable pull-up resistor
+  digitalWrite(BUTTON_PIN, HIGH);
+
+  Serial.begin(115200);
+
+  // use Serial3 (Mega-only) to talk to the iPod
+  Serial3.begin(iPodSerial::IPOD_SERIAL_RATE);
+  advancedRemote.setSerial(Serial3);
+  advancedRemote.setReceiveBudget(RECEIVE_BUDGET_BYTES, 0);
+
+  advancedRemote.setItemCountHandler(itemCountHandler);
+  advancedRemote.setItemNameHandler(itemNameHandler);
+
+  // start disabled, i.e. in good old Simple Remote mode
+  advancedRemote.disable();
+
+  Serial.print("Loop period (ms): ");
+  Serial.println(LOOP_PERIOD_MS);
+  Serial.println("Press the button to start the dump");
+}
+
+void loop()
+{
+  // a full receive buffer means the hardware has had nowhere to put
+  // any further bytes, so count it as (at least) one overrun
+  if (Serial3.available() >= SERIAL_RX_BUFFER_SIZE - 1)
+  {
+    ++overruns;
+  }
+
+  advancedRemote.loop();
+
+  const byte framesThisLoop = advancedRemote.getLastLoopFrameCount();
+  frames += framesThisLoop;
+  if (framesThisLoop > maxFramesPerLoop)
+  {
+    maxFramesPerLoop = framesThisLoop;
+  }
+  ++loops;
+
+  if (button.update() && (button.read() == LOW))
+  {
+    if (advancedRemote.isCurrentlyEnabled())
+    {
+      advancedRemote.disable();
+    }
+    else
+    {
+      names = 0;
+      advancedRemote.enable();
+      advancedRemote.switchToMainLibraryPlaylist();
+      advancedRemote.getItemCount(AdvancedRemote::ITEM_SONG);
+    }
+  }
+
+  if (millis() - lastReportMs >= REPORT_PERIOD_MS)
+  {
+    lastReportMs = millis();
+    report();
+  }
+
+  // stand-in for the rest of a busy sketch
+  delay(LOOP_PERIOD_MS);
+}
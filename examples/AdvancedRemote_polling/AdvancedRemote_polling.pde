@@ -142,6 +142,18 @@ void pollingHandler(AdvancedRemote::PollingCommand command,
     }
 }
 
+#if IPOD_SERIAL_REQUEST_TIMEOUTS
+void timeoutHandler(byte cmd)
+{
+  // without this, a request the iPod never answers would leave
+  // us waiting forever for the next step in our chain of handlers
+  Serial.print("iPod didn't answer cmd 0x");
+  Serial.print(cmd, HEX);
+  Serial.println(" even after retrying; press the button to start again");
+  advancedRemote.disable();
+}
+#endif
+
 void printTime(const unsigned long ms)
 {
   const unsigned long totalSecs = ms / 1000;
@@ -182,6 +194,14 @@ void setup()
   advancedRemote.setPollingHandler(pollingHandler);
   advancedRemote.setCurrentPlaylistSongCountHandler(currentPlaylistSongCountHandler);
 
+#if IPOD_SERIAL_REQUEST_TIMEOUTS
+  // give the iPod a second to answer each request, and ask twice more if it
+  // doesn't (only if the library was built with IPOD_SERIAL_REQUEST_TIMEOUTS
+  // defined as 1; see AdvancedRemote.h)
+  advancedRemote.setTimeoutHandler(timeoutHandler);
+  advancedRemote.setRequestTimeout(1000, 2);
+#endif
+
   // start in simple remote mode
   advancedRemote.disable();
 }
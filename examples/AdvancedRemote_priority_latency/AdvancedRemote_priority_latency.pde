@@ -0,0 +1,98 @@
+// Measures how long a button press takes to get onto the wire while the
+// library is busy with bulk traffic: it keeps the background transmit
+// queue topped up with getTitle requests (standing in for a library dump)
+// and sends play/pause when the button is pressed.
+//
+// Every second it prints the latency of the most recent play/pause, the
+// worst seen so far, and how many background requests went out.
+//
+// With a single shared queue the play/pause would have to wait behind
+// everything already queued: at 19200 baud that's about half a millisecond
+// per byte, so over 60ms for a full 128 byte queue. With its own queue it
+// only has to wait for the frame that's already going out.
+//
+// If your iPod ends up stuck with the "OK to disconnect" message on its display,
+// reset the Arduino or the iPod.
+
+#include <AdvancedRemote.h>
+#include <Bounce.h>
+
+// This sketch needs to be adapted (change serial port config in setup())
+// to be used on a non-Mega, so check the board here so people notice.
+#if !defined(__AVR_ATmega1280__)
+#error "This example is for the Mega, because it uses Serial3 for the iPod and Serial for the results"
+#endif
+
+const byte BUTTON_PIN = 22;
+const unsigned long DEBOUNCE_MS = 50;
+
+const unsigned long REPORT_PERIOD_MS = 1000;
+
+Bounce button(BUTTON_PIN, DEBOUNCE_MS);
+AdvancedRemote advancedRemote;
+
+byte backgroundQueue[128];
+byte interactiveQueue[32];
+
+unsigned long backgroundRequests = 0;
+unsigned long presses = 0;
+unsigned long lastReportMs = 0;
+
+void report()
+{
+  Serial.print("presses=");
+  Serial.print(presses);
+  Serial.print(" last latency (us)=");
+  Serial.print(advancedRemote.getLastInteractiveLatencyMicros());
+  Serial.print(" max latency (us)=");
+  Serial.print(advancedRemote.getMaxInteractiveLatencyMicros());
+  Serial.print(" background requests=");
+  Serial.println(backgroundRequests);
+
+  backgroundRequests = 0;
+}
+
+void setup()
+{
+  pinMode(BUTTON_PIN, INPUT);
+
+  // enable pull-up resistor
+  digitalWrite(BUTTON_PIN, HIGH);
+
+  Serial.begin(115200);
+
+  // use Serial3 (Mega-only) to talk to the iPod
+  Serial3.begin(iPodSerial::IPOD_SERIAL_RATE);
+  advancedRemote.setSerial(Serial3);
+
+  advancedRemote.setTransmitQueue(backgroundQueue, sizeof(backgroundQueue));
+  advancedRemote.setTransmitQueue(interactiveQueue, sizeof(interactiveQueue),
+                                  iPodSerial::PRIORITY_INTERACTIVE);
+
+  advancedRemote.enable();
+}
+
+void loop()
+{
+  advancedRemote.loop();
+
+  // keep the wire busy; this fails harmlessly once the queue is full
+  if (advancedRemote.getTitle(backgroundRequests))
+  {
+    ++backgroundRequests;
+  }
+
+  if (button.update() && (button.read() == LOW))
+  {
+    if (advancedRemote.controlPlayback(AdvancedRemote::PLAYBACK_CONTROL_PLAY_PAUSE))
+    {
+      ++presses;
+    }
+  }
+
+  if (millis() - lastReportMs >= REPORT_PERIOD_MS)
+  {
+    lastReportMs = millis();
+    report();
+  }
+}
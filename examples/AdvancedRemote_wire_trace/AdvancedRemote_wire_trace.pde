@@ -0,0 +1,118 @@
+// Keeps a wire trace of the last 512 bytes to and from the iPod while the
+// sketch polls for the track title, and saves it to EEPROM when the button
+// is pressed, so that whatever just went wrong can be looked at later
+// without IPOD_SERIAL_DEBUG's printing changing the timing.
+//
+// Send a 'd' over the USB serial port to have the saved trace sent back as
+// raw bytes. Capture it to a file with a terminal program and play it back
+// on a PC with extras/host/trace_replay.
+//
+// If your iPod ends up stuck with the "OK to disconnect" message on its display,
+// reset the Arduino or the iPod.
+
+#include <AdvancedRemote.h>
+#include <Bounce.h>
+#include <EEPROM.h>
+
+// This sketch needs to be adapted (change serial port config in setup())
+// to be used on a non-Mega, so check the board here so people notice.
+#if !defined(__AVR_ATmega1280__)
+#error "This example is for the Mega, because it uses Serial3 for the iPod and Serial for the results"
+#endif
+
+const byte BUTTON_PIN = 22;
+const unsigned long DEBOUNCE_MS = 50;
+
+const unsigned long TITLE_PERIOD_MS = 2000;
+
+// a Print that writes to EEPROM from the start
+class EEPROMPrint : public Print
+{
+public:
+  EEPROMPrint() : address(0) {}
+
+  virtual size_t write(uint8_t b)
+  {
+    if (address >= E2END + 1)
+    {
+      return 0;
+    }
+    EEPROM.write(address++, b);
+    return 1;
+  }
+
+private:
+  int address;
+};
+
+Bounce button(BUTTON_PIN, DEBOUNCE_MS);
+AdvancedRemote advancedRemote;
+
+byte traceBuffer[512 * AAPWireTrace::RECORD_SIZE];
+
+unsigned long lastTitleMs = 0;
+
+void titleHandler(const char *title)
+{
+  Serial.print("Title: ");
+  Serial.println(title);
+}
+
+// sends back the trace saved in EEPROM, if there is one
+void sendSavedTrace()
+{
+  if ((EEPROM.read(0) != 'A') || (EEPROM.read(1) != 'A') ||
+      (EEPROM.read(2) != 'P') || (EEPROM.read(3) != 'T'))
+  {
+    return;
+  }
+
+  const unsigned long records = ((unsigned long) EEPROM.read(7) << 8) | EEPROM.read(8);
+  const int length = 9 + records * AAPWireTrace::RECORD_SIZE;
+  for (int address = 0; address < length; ++address)
+  {
+    Serial.write(EEPROM.read(address));
+  }
+}
+
+void setup()
+{
+  pinMode(BUTTON_PIN, INPUT);
+
+  // enable pull-up resistor
+  digitalWrite(BUTTON_PIN, HIGH);
+
+  Serial.begin(115200);
+
+  // use Serial3 (Mega-only) to talk to the iPod
+  Serial3.begin(iPodSerial::IPOD_SERIAL_RATE);
+  advancedRemote.setSerial(Serial3);
+
+  advancedRemote.setTitleHandler(titleHandler);
+  advancedRemote.setWireTrace(traceBuffer, sizeof(traceBuffer));
+
+  advancedRemote.enable();
+}
+
+void loop()
+{
+  advancedRemote.loop();
+
+  if (millis() - lastTitleMs >= TITLE_PERIOD_MS)
+  {
+    lastTitleMs = millis();
+    advancedRemote.getTitle(0);
+  }
+
+  if (button.update() && (button.read() == LOW))
+  {
+    EEPROMPrint eeprom;
+    advancedRemote.dumpWireTrace(eeprom);
+    Serial.println("Trace saved");
+  }
+
+  if ((Serial.available() > 0) && (Serial.read() == 'd'))
+  {
+    sendSavedTrace();
+  }
+}
@@ -0,0 +1,140 @@
+// Benchmark of the CPU time taken to send commands, comparing the original
+// byte-at-a-time transmit path (one write() per byte, checksum updated as
+// it goes) with the current one (whole frame assembled, then one write()).
+//
+// Commands are sent to a Stream that throws everything away, so what's
+// measured is the library's own cost rather than the time the bytes take
+// to go out of the serial port. Results are printed to Serial at 115200
+// baud. No iPod is needed.
+
+#include <AdvancedRemote.h>
+#include <SimpleRemote.h>
+
+const unsigned int ITERATIONS = 1000;
+
+// a Stream that accepts everything and keeps nothing; it also accepts
+// whole buffers in one call, as the serial ports on newer boards do
+class NullStream : public Stream
+{
+public:
+  size_t bytesWritten;
+
+  NullStream() : bytesWritten(0) {}
+
+  virtual size_t write(uint8_t) { ++bytesWritten; return 1; }
+  virtual size_t write(const uint8_t *, size_t size) { bytesWritten += size; return size; }
+  virtual int available() { return 0; }
+  virtual int read() { return -1; }
+  virtual int peek() { return -1; }
+  virtual void flush() {}
+};
+
+//
+// a copy of the transmit path as it was before whole-frame sending
+//
+class OldSender
+{
+public:
+  OldSender(Stream &s) : pSerial(&s), checksum(0) {}
+
+  void getItemNames(byte itemType, unsigned long offset, unsigned long count)
+  {
+    sendHeader();
+    sendLength(1 + 1 + 1 + 1 + (2 * 4));
+    sendByte(0x04);
+    sendByte(0x00);
+    sendByte(0x1A);
+    sendByte(itemType);
+    sendNumber(offset);
+    sendNumber(count);
+    sendChecksum();
+  }
+
+  void getTitle(unsigned long index)
+  {
+    sendHeader();
+    sendLength(1 + 1 + 1 + 4);
+    sendByte(0x04);
+    sendByte(0x00);
+    sendByte(0x20);
+    sendNumber(index);
+    sendChecksum();
+  }
+
+  void sendPlay()
+  {
+    static const byte play[] = {0x02, 0x00, 0x01};
+    sendHeader();
+    sendLength(sizeof(play));
+    for (size_t i = 0; i < sizeof(play); i++)
+    {
+      sendByte(play[i]);
+    }
+    sendChecksum();
+  }
+
+private:
+  Stream *pSerial;
+  byte checksum;
+
+  void sendHeader() { sendByte(0xFF); sendByte(0x55); }
+  void sendLength(size_t length) { sendByte(length); checksum = length; }
+  void sendByte(byte b) { pSerial->write(b); checksum += b; }
+  void sendNumber(unsigned long n)
+  {
+    sendByte((n & 0xFF000000) >> 24);
+    sendByte((n & 0x00FF0000) >> 16);
+    sendByte((n & 0x0000FF00) >> 8);
+    sendByte((n & 0x000000FF) >> 0);
+  }
+  void sendChecksum() { sendByte((0x100 - checksum) & 0xFF); }
+};
+
+NullStream nullStream;
+OldSender oldSender(nullStream);
+AdvancedRemote advancedRemote;
+SimpleRemote simpleRemote;
+
+void report(const char *name, unsigned long oldMicros, unsigned long newMicros)
+{
+  Serial.print(name);
+  Serial.print(", ");
+  Serial.print((float) oldMicros / ITERATIONS);
+  Serial.print(", ");
+  Serial.println((float) newMicros / ITERATIONS);
+}
+
+void setup()
+{
+  Serial.begin(115200);
+
+  advancedRemote.setSerial(nullStream);
+  simpleRemote.setSerial(nullStream);
+
+  Serial.println("command, old us/command, new us/command");
+
+  unsigned long start = micros();
+  for (unsigned int i = 0; i < ITERATIONS; ++i) oldSender.getItemNames(AdvancedRemote::ITEM_SONG, i, 1);
+  unsigned long oldTime = micros() - start;
+  start = micros();
+  for (unsigned int i = 0; i < ITERATIONS; ++i) advancedRemote.getItemNames(AdvancedRemote::ITEM_SONG, i, 1);
+  report("getItemNames", oldTime, micros() - start);
+
+  start = micros();
+  for (unsigned int i = 0; i < ITERATIONS; ++i) oldSender.getTitle(i);
+  oldTime = micros() - start;
+  start = micros();
+  for (unsigned int i = 0; i < ITERATIONS; ++i) advancedRemote.getTitle(i);
+  report("getTitle", oldTime, micros() - start);
+
+  start = micros();
+  for (unsigned int i = 0; i < ITERATIONS; ++i) oldSender.sendPlay();
+  oldTime = micros() - start;
+  start = micros();
+  for (unsigned int i = 0; i < ITERATIONS; ++i) simpleRemote.sendPlay();
+  report("sendPlay", oldTime, micros() - start);
+}
+
+void loop()
+{
+}
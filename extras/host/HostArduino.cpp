@@ -0,0 +1,298 @@
+/*******************************************************************************
+ * Copyright (c) 2009 David Findlay
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *    - Redistributions of source code must retain the above copyright notice,
+ *      this list of conditions and the following disclaimer.
+ *    - Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ ******************************************************************************/
+
+#include "Arduino.h"
+#include "HostClock.h"
+
+#include <stdio.h>
+#include <time.h>
+
+HostSerial Serial;
+
+namespace
+{
+    unsigned long long monotonicMicros()
+    {
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        return (unsigned long long) now.tv_sec * 1000000ULL + now.tv_nsec / 1000;
+    }
+
+    // like on an Arduino, time starts when the program does
+    const unsigned long long START_MICROS = monotonicMicros();
+
+    bool virtualTime = false;
+    unsigned long long virtualNanos = 0;
+
+    unsigned long long nowMicros()
+    {
+        return virtualTime ? virtualNanos / 1000 : monotonicMicros() - START_MICROS;
+    }
+}
+
+void setVirtualTime(bool enable)
+{
+    virtualTime = enable;
+    virtualNanos = 0;
+}
+
+bool isVirtualTime()
+{
+    return virtualTime;
+}
+
+unsigned long long getVirtualNanos()
+{
+    return virtualNanos;
+}
+
+void setVirtualNanos(unsigned long long nanos)
+{
+    if (nanos > virtualNanos)
+    {
+        virtualNanos = nanos;
+    }
+}
+
+void advanceVirtualNanos(unsigned long long nanos)
+{
+    virtualNanos += nanos;
+}
+
+unsigned long millis()
+{
+    return (unsigned long) (nowMicros() / 1000);
+}
+
+unsigned long micros()
+{
+    return (unsigned long) nowMicros();
+}
+
+void delay(unsigned long ms)
+{
+    if (virtualTime)
+    {
+        advanceVirtualNanos(ms * 1000000ULL);
+        return;
+    }
+
+    const unsigned long long end = monotonicMicros() + ms * 1000ULL;
+    struct timespec pause = { 0, 1000000 };
+    while (monotonicMicros() < end)
+    {
+        nanosleep(&pause, 0);
+    }
+}
+
+void delayMicroseconds(unsigned int us)
+{
+    if (virtualTime)
+    {
+        advanceVirtualNanos(us * 1000ULL);
+        return;
+    }
+
+    const unsigned long long end = monotonicMicros() + us;
+    while (monotonicMicros() < end)
+    {
+    }
+}
+
+size_t Print::write(const uint8_t *buffer, size_t size)
+{
+    size_t written = 0;
+    while (size--)
+    {
+        written += write(*buffer++);
+    }
+    return written;
+}
+
+size_t Print::write(const char *str)
+{
+    return write((const uint8_t *) str, strlen(str));
+}
+
+int Print::availableForWrite()
+{
+    return 0;
+}
+
+void Print::flush()
+{
+}
+
+size_t Print::print(const __FlashStringHelper *str)
+{
+    return write(reinterpret_cast<const char *>(str));
+}
+
+size_t Print::print(const char str[])
+{
+    return write(str);
+}
+
+size_t Print::print(char c)
+{
+    return write((uint8_t) c);
+}
+
+size_t Print::print(unsigned char n, int base)
+{
+    return printNumber(n, base);
+}
+
+size_t Print::print(int n, int base)
+{
+    return print((long) n, base);
+}
+
+size_t Print::print(unsigned int n, int base)
+{
+    return printNumber(n, base);
+}
+
+size_t Print::print(long n, int base)
+{
+    if ((base == DEC) && (n < 0))
+    {
+        return print('-') + printNumber(-(unsigned long) n, DEC);
+    }
+    return printNumber((unsigned long) n, base);
+}
+
+size_t Print::print(unsigned long n, int base)
+{
+    return printNumber(n, base);
+}
+
+size_t Print::print(double n, int digits)
+{
+    char buffer[64];
+    snprintf(buffer, sizeof(buffer), "%.*f", digits, n);
+    return write(buffer);
+}
+
+size_t Print::println(const __FlashStringHelper *str)
+{
+    return print(str) + println();
+}
+
+size_t Print::println(const char str[])
+{
+    return print(str) + println();
+}
+
+size_t Print::println(char c)
+{
+    return print(c) + println();
+}
+
+size_t Print::println(unsigned char n, int base)
+{
+    return print(n, base) + println();
+}
+
+size_t Print::println(int n, int base)
+{
+    return print(n, base) + println();
+}
+
+size_t Print::println(unsigned int n, int base)
+{
+    return print(n, base) + println();
+}
+
+size_t Print::println(long n, int base)
+{
+    return print(n, base) + println();
+}
+
+size_t Print::println(unsigned long n, int base)
+{
+    return print(n, base) + println();
+}
+
+size_t Print::println(double n, int digits)
+{
+    return print(n, digits) + println();
+}
+
+size_t Print::println()
+{
+    return write("\r\n");
+}
+
+size_t Print::printNumber(unsigned long n, int base)
+{
+    if (base < 2)
+    {
+        base = 10;
+    }
+
+    // enough for a 64-bit number in binary
+    char buffer[8 * sizeof(n) + 1];
+    char *p = &buffer[sizeof(buffer) - 1];
+    *p = '\0';
+    do
+    {
+        const int digit = n % base;
+        n /= base;
+        *--p = (digit < 10) ? ('0' + digit) : ('A' + digit - 10);
+    } while (n);
+
+    return write(p);
+}
+
+size_t HostSerial::write(uint8_t b)
+{
+    return (putchar(b) == EOF) ? 0 : 1;
+}
+
+size_t HostSerial::write(const uint8_t *buffer, size_t size)
+{
+    return fwrite(buffer, 1, size, stdout);
+}
+
+int HostSerial::available()
+{
+    return 0;
+}
+
+int HostSerial::read()
+{
+    return -1;
+}
+
+int HostSerial::peek()
+{
+    return -1;
+}
+
+void HostSerial::flush()
+{
+    fflush(stdout);
+}
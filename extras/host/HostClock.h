@@ -0,0 +1,52 @@
+#ifndef HOST_CLOCK_H
+#define HOST_CLOCK_H
+/*******************************************************************************
+ * Copyright (c) 2009 David Findlay
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *    - Redistributions of source code must retain the above copyright notice,
+ *      this list of conditions and the following disclaimer.
+ *    - Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ ******************************************************************************/
+
+/**
+ * Virtual time for the host build. Normally millis() and micros() follow
+ * the real clock, but a PC runs the library far faster than an Arduino and
+ * a serial link can carry bytes, so timings measured that way don't mean
+ * much. With virtual time turned on the clock only moves when it's told to
+ * (by SerialLink, or by delay()), so it can be made to follow a model of
+ * the real link instead.
+ *
+ * Virtual time starts from 0 when it's turned on, and is kept in
+ * nanoseconds so that per-byte times at odd baud rates don't drift.
+ */
+
+void setVirtualTime(bool enable);
+bool isVirtualTime();
+
+unsigned long long getVirtualNanos();
+
+/**
+ * Moves virtual time forward; it never goes backwards, so earlier
+ * times are ignored.
+ */
+void setVirtualNanos(unsigned long long nanos);
+void advanceVirtualNanos(unsigned long long nanos);
+
+#endif // HOST_CLOCK_H
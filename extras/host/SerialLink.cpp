@@ -0,0 +1,252 @@
+/*******************************************************************************
+ * Copyright (c) 2009 David Findlay
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *    - Redistributions of source code must retain the above copyright notice,
+ *      this list of conditions and the following disclaimer.
+ *    - Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ ******************************************************************************/
+
+#include "SerialLink.h"
+#include "HostClock.h"
+
+SerialLink::SerialLink(Stream &device, unsigned long baudRate)
+    : device(device),
+      baudRate(baudRate ? baudRate : 1),
+      bitsPerByte(10),
+      byteNanos(0),
+      devicePollNanos(0),
+      transmitSize(64),
+      receiveSize(64),
+      transmitDoneNanos(0),
+      receiving(false),
+      receivingByte(0),
+      receiveDoneNanos(0),
+      nextPollNanos(0),
+      bytesToDevice(0),
+      bytesFromDevice(0),
+      receiveOverruns(0),
+      transmitBlockedNanos(0),
+      peakReceiveFill(0)
+{
+    if (!isVirtualTime())
+    {
+        setVirtualTime(true);
+    }
+    updateByteNanos();
+}
+
+void SerialLink::setBitsPerByte(byte bits)
+{
+    bitsPerByte = bits;
+    updateByteNanos();
+}
+
+void SerialLink::setBufferSizes(size_t newTransmitSize, size_t newReceiveSize)
+{
+    transmitSize = newTransmitSize ? newTransmitSize : 1;
+    receiveSize = newReceiveSize;
+}
+
+void SerialLink::setDevicePollNanos(unsigned long long nanos)
+{
+    devicePollNanos = nanos ? nanos : 1;
+}
+
+void SerialLink::updateByteNanos()
+{
+    byteNanos = (bitsPerByte * 1000000000ULL + baudRate / 2) / baudRate;
+    devicePollNanos = byteNanos / 10 ? byteNanos / 10 : 1;
+}
+
+unsigned long long SerialLink::getByteNanos() const
+{
+    return byteNanos;
+}
+
+void SerialLink::advance(unsigned long micros)
+{
+    advanceNanos(micros * 1000ULL);
+}
+
+void SerialLink::advanceNanos(unsigned long long nanos)
+{
+    runUntil(getVirtualNanos() + nanos);
+}
+
+unsigned long SerialLink::getBytesToDevice() const
+{
+    return bytesToDevice;
+}
+
+unsigned long SerialLink::getBytesFromDevice() const
+{
+    return bytesFromDevice;
+}
+
+unsigned long SerialLink::getReceiveOverruns() const
+{
+    return receiveOverruns;
+}
+
+unsigned long long SerialLink::getTransmitBlockedNanos() const
+{
+    return transmitBlockedNanos;
+}
+
+size_t SerialLink::getPeakReceiveFill() const
+{
+    return peakReceiveFill;
+}
+
+size_t SerialLink::write(uint8_t b)
+{
+    runUntil(getVirtualNanos());
+
+    if (transmitBuffer.size() >= transmitSize)
+    {
+        // like HardwareSerial, wait for the byte on the wire to go
+        const unsigned long long start = getVirtualNanos();
+        runUntil(transmitDoneNanos);
+        transmitBlockedNanos += getVirtualNanos() - start;
+    }
+
+    if (transmitBuffer.empty())
+    {
+        transmitDoneNanos = getVirtualNanos() + byteNanos;
+    }
+    transmitBuffer.push_back(b);
+    return 1;
+}
+
+size_t SerialLink::write(const uint8_t *buffer, size_t size)
+{
+    for (size_t i = 0; i < size; ++i)
+    {
+        write(buffer[i]);
+    }
+    return size;
+}
+
+int SerialLink::availableForWrite()
+{
+    runUntil(getVirtualNanos());
+    return transmitSize - transmitBuffer.size();
+}
+
+int SerialLink::available()
+{
+    runUntil(getVirtualNanos());
+    return receiveBuffer.size();
+}
+
+int SerialLink::read()
+{
+    const int b = peek();
+    if (b >= 0)
+    {
+        receiveBuffer.pop_front();
+    }
+    return b;
+}
+
+int SerialLink::peek()
+{
+    runUntil(getVirtualNanos());
+    return receiveBuffer.empty() ? -1 : receiveBuffer.front();
+}
+
+void SerialLink::runUntil(unsigned long long targetNanos)
+{
+    // Deal with everything that happens up to the target time in order,
+    // with the clock showing the time each thing happens at, so that the
+    // device sees commands arrive when they really would.
+    for (;;)
+    {
+        const unsigned long long now = getVirtualNanos();
+        if (nextPollNanos < now)
+        {
+            nextPollNanos = now;
+        }
+
+        unsigned long long next = targetNanos;
+        if (!transmitBuffer.empty() && (transmitDoneNanos < next))
+        {
+            next = transmitDoneNanos;
+        }
+        if (receiving && (receiveDoneNanos < next))
+        {
+            next = receiveDoneNanos;
+        }
+        if (!receiving && (nextPollNanos < next))
+        {
+            next = nextPollNanos;
+        }
+        setVirtualNanos(next);
+        const unsigned long long at = getVirtualNanos();
+
+        if (!transmitBuffer.empty() && (transmitDoneNanos <= at))
+        {
+            device.write(transmitBuffer.front());
+            transmitBuffer.pop_front();
+            ++bytesToDevice;
+            // the next byte follows straight on
+            transmitDoneNanos += byteNanos;
+        }
+
+        if (receiving && (receiveDoneNanos <= at))
+        {
+            receiving = false;
+            if (receiveBuffer.size() < receiveSize)
+            {
+                receiveBuffer.push_back(receivingByte);
+                if (receiveBuffer.size() > peakReceiveFill)
+                {
+                    peakReceiveFill = receiveBuffer.size();
+                }
+                ++bytesFromDevice;
+            }
+            else
+            {
+                ++receiveOverruns;
+            }
+        }
+
+        if (!receiving && (nextPollNanos <= at))
+        {
+            if (device.available() > 0)
+            {
+                // straight after the last byte, or as soon as the device
+                // has something to say if the link was idle
+                receivingByte = device.read();
+                receiving = true;
+                receiveDoneNanos = at + byteNanos;
+            }
+            else
+            {
+                nextPollNanos = at + devicePollNanos;
+            }
+        }
+
+        if (at >= targetNanos)
+        {
+            return;
+        }
+    }
+}
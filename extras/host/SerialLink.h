@@ -0,0 +1,142 @@
+#ifndef SERIAL_LINK_H
+#define SERIAL_LINK_H
+/*******************************************************************************
+ * Copyright (c) 2009 David Findlay
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *    - Redistributions of source code must retain the above copyright notice,
+ *      this list of conditions and the following disclaimer.
+ *    - Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ ******************************************************************************/
+
+#include "Arduino.h"
+
+#include <deque>
+
+/**
+ * A model of the serial link between the Arduino and the iPod, run in
+ * virtual time (see HostClock.h) so that latencies measured on a PC are
+ * the ones you'd see on the real thing.
+ *
+ * Give the library the link with setSerial(), and the link the device at
+ * the other end (normally a SimulatediPod). Every byte then takes as long
+ * to cross the wire as it would at the link's baud rate, in each
+ * direction independently, and the Arduino's serial buffers are modelled
+ * too: writing to a full transmit buffer blocks, moving virtual time on
+ * until there's room (as HardwareSerial does), and bytes arriving when
+ * the receive buffer is full are lost (and counted). How long the iPod
+ * takes to answer is up to the device; see
+ * SimulatediPod::setResponseDelayMicros().
+ *
+ * Time only moves when the sketch's side says so, with advance(): a loop
+ * that calls the library's loop() and then advance() by however long the
+ * rest of the sketch takes gives a reasonable picture of a real sketch.
+ * Use advance() rather than delay() so that things happen in the right
+ * order.
+ */
+class SerialLink : public Stream
+{
+public: // methods
+    /**
+     * Turns on virtual time if it isn't already.
+     */
+    SerialLink(Stream &device, unsigned long baudRate);
+
+    /**
+     * 8N1 framing (10 bits per byte) is the default.
+     */
+    void setBitsPerByte(byte bits);
+
+    /**
+     * The sizes of the Arduino's serial buffers. The defaults are the 64
+     * bytes HardwareSerial uses on boards with more than 1KB of RAM.
+     */
+    void setBufferSizes(size_t transmitSize, size_t receiveSize);
+
+    /**
+     * How often the device is checked for something to send while the
+     * link is idle, which bounds how late the first byte of a response
+     * can start. The default is a tenth of a byte time.
+     */
+    void setDevicePollNanos(unsigned long long nanos);
+
+    /**
+     * Moves virtual time on, delivering bytes in each direction as they
+     * finish crossing the wire.
+     */
+    void advance(unsigned long micros);
+    void advanceNanos(unsigned long long nanos);
+
+    unsigned long long getByteNanos() const;
+
+    /**
+     * Statistics: bytes that made it across in each direction, bytes lost
+     * because the receive buffer was full, how long writes spent blocked
+     * waiting for room in the transmit buffer, and the most that was ever
+     * waiting in the receive buffer.
+     */
+    unsigned long getBytesToDevice() const;
+    unsigned long getBytesFromDevice() const;
+    unsigned long getReceiveOverruns() const;
+    unsigned long long getTransmitBlockedNanos() const;
+    size_t getPeakReceiveFill() const;
+
+    /**
+     * The Stream interface the library talks to.
+     */
+    virtual size_t write(uint8_t b);
+    virtual size_t write(const uint8_t *buffer, size_t size);
+    virtual int availableForWrite();
+    virtual int available();
+    virtual int read();
+    virtual int peek();
+
+private: // attributes
+    Stream &device;
+    unsigned long baudRate;
+    byte bitsPerByte;
+    unsigned long long byteNanos;
+    unsigned long long devicePollNanos;
+
+    size_t transmitSize;
+    size_t receiveSize;
+
+    // bytes waiting to go to the device; the first is on the wire
+    std::deque<byte> transmitBuffer;
+    unsigned long long transmitDoneNanos;
+
+    // bytes that have arrived from the device
+    std::deque<byte> receiveBuffer;
+    bool receiving;
+    byte receivingByte;
+    unsigned long long receiveDoneNanos;
+    unsigned long long nextPollNanos;
+
+    unsigned long bytesToDevice;
+    unsigned long bytesFromDevice;
+    unsigned long receiveOverruns;
+    unsigned long long transmitBlockedNanos;
+    size_t peakReceiveFill;
+
+private: // methods
+    void updateByteNanos();
+    void runUntil(unsigned long long targetNanos);
+};
+
+#endif // SERIAL_LINK_H
@@ -0,0 +1,914 @@
+/*******************************************************************************
+ * Copyright (c) 2009 David Findlay
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *    - Redistributions of source code must retain the above copyright notice,
+ *      this list of conditions and the following disclaimer.
+ *    - Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ ******************************************************************************/
+
+#include "SimulatediPod.h"
+
+#include <stdio.h>
+
+namespace
+{
+    const byte MODE_SWITCHING_MODE = 0x00;
+
+    // Advanced Remote commands; each response is the command plus one
+    const byte RESPONSE_FEEDBACK = 0x01;
+    const byte CMD_GET_IPOD_NAME = 0x14;
+    const byte CMD_SWITCH_TO_MAIN_LIBRARY_PLAYLIST = 0x16;
+    const byte CMD_SWITCH_TO_ITEM = 0x17;
+    const byte CMD_GET_ITEM_COUNT = 0x18;
+    const byte CMD_GET_ITEM_NAMES = 0x1A;
+    const byte CMD_GET_TIME_AND_STATUS_INFO = 0x1C;
+    const byte CMD_GET_PLAYLIST_POSITION = 0x1E;
+    const byte CMD_GET_TITLE = 0x20;
+    const byte CMD_GET_ARTIST = 0x22;
+    const byte CMD_GET_ALBUM = 0x24;
+    const byte CMD_POLLING_MODE = 0x26;
+    const byte CMD_EXECUTE_SWITCH = 0x28;
+    const byte CMD_PLAYBACK_CONTROL = 0x29;
+    const byte CMD_GET_SHUFFLE_MODE = 0x2C;
+    const byte CMD_SET_SHUFFLE_MODE = 0x2E;
+    const byte CMD_GET_REPEAT_MODE = 0x2F;
+    const byte CMD_SET_REPEAT_MODE = 0x31;
+    const byte CMD_GET_SONG_COUNT_IN_CURRENT_PLAYLIST = 0x35;
+    const byte CMD_JUMP_TO_SONG_IN_CURRENT_PLAYLIST = 0x37;
+
+    const byte FEEDBACK_SUCCESS = 0x00;
+    const byte FEEDBACK_FAILURE = 0x02;
+    const byte FEEDBACK_INVALID_PARAM = 0x04;
+
+    const byte ITEM_PLAYLIST = 0x01;
+    const byte ITEM_ARTIST = 0x02;
+    const byte ITEM_ALBUM = 0x03;
+    const byte ITEM_GENRE = 0x04;
+    const byte ITEM_SONG = 0x05;
+    const byte ITEM_COMPOSER = 0x06;
+
+    const byte POLLING_TRACK_CHANGE = 0x01;
+    const byte POLLING_ELAPSED_TIME = 0x04;
+
+    const byte STATUS_STOPPED = 0;
+    const byte STATUS_PLAYING = 1;
+    const byte STATUS_PAUSED = 2;
+
+    const byte PLAYBACK_CONTROL_PLAY_PAUSE = 0x01;
+    const byte PLAYBACK_CONTROL_STOP = 0x02;
+    const byte PLAYBACK_CONTROL_SKIP_FORWARD = 0x03;
+    const byte PLAYBACK_CONTROL_SKIP_BACKWARD = 0x04;
+    const byte PLAYBACK_CONTROL_STOP_FF_OR_REV = 0x07;
+
+    const byte REPEAT_MODE_ONE_SONG = 0x01;
+    const byte REPEAT_MODE_ALL_SONGS = 0x02;
+
+    // Simple Remote buttons, first button byte in the bottom bits
+    const unsigned long BUTTON_PLAY_PAUSE = 0x000001;
+    const unsigned long BUTTON_SKIP_FORWARD = 0x000008;
+    const unsigned long BUTTON_SKIP_BACKWARD = 0x000010;
+    const unsigned long BUTTON_STOP = 0x000080;
+    const unsigned long BUTTON_JUST_PLAY = 0x000100;
+    const unsigned long BUTTON_JUST_PAUSE = 0x000200;
+    const unsigned long BUTTON_TOGGLE_SHUFFLE = 0x008000;
+    const unsigned long BUTTON_TOGGLE_REPEAT = 0x010000;
+
+    // going back any later than this into a track restarts it instead
+    const unsigned long RESTART_TRACK_MILLIS = 3000;
+}
+
+SimulatediPod::SimulatediPod()
+    : parser(commandBuffer, sizeof(commandBuffer)),
+      responseDelayMicros(0),
+      byteErrorRate(0),
+      randomState(1),
+      mode(MODE_SIMPLE_REMOTE),
+      currentPlaylist(0),
+      selectedPlaylist(0),
+      playlistPosition(0),
+      playing(false),
+      elapsedMillis(0),
+      lastUpdateMillis(millis()),
+      shuffleMode(0),
+      repeatMode(0),
+      polling(false),
+      lastPollMillis(0),
+      buttons(0),
+      buttonPressCount(0),
+      commandCount(0),
+      badCommandCount(0),
+      responseCount(0),
+      corruptedByteCount(0)
+{
+    library.songCount = 1000;
+    library.playlistCount = 20;
+    library.artistCount = 100;
+    library.albumCount = 80;
+    library.genreCount = 10;
+    library.composerCount = 50;
+    library.trackLengthMillis = 180000;
+}
+
+void SimulatediPod::setLibrary(const Library &newLibrary)
+{
+    library = newLibrary;
+
+    // there's always the main library playlist, and nothing can be
+    // over before it's started
+    if (library.playlistCount == 0)
+    {
+        library.playlistCount = 1;
+    }
+    if (library.artistCount == 0)
+    {
+        library.artistCount = 1;
+    }
+    if (library.albumCount == 0)
+    {
+        library.albumCount = 1;
+    }
+    if (library.trackLengthMillis == 0)
+    {
+        library.trackLengthMillis = 1;
+    }
+
+    currentPlaylist = 0;
+    selectedPlaylist = 0;
+    playlistPosition = 0;
+    elapsedMillis = 0;
+}
+
+const SimulatediPod::Library &SimulatediPod::getLibrary() const
+{
+    return library;
+}
+
+void SimulatediPod::setResponseDelayMicros(unsigned long delayMicros)
+{
+    responseDelayMicros = delayMicros;
+}
+
+void SimulatediPod::setByteErrorRate(double rate, unsigned long seed)
+{
+    byteErrorRate = rate;
+    // xorshift gets stuck on zero
+    randomState = seed ? seed : 1;
+}
+
+SimulatediPod::Mode SimulatediPod::getMode() const
+{
+    return mode;
+}
+
+bool SimulatediPod::isPlaying() const
+{
+    return playing;
+}
+
+unsigned long SimulatediPod::getCurrentPlaylist() const
+{
+    return currentPlaylist;
+}
+
+unsigned long SimulatediPod::getPlaylistPosition() const
+{
+    return playlistPosition;
+}
+
+byte SimulatediPod::getShuffleMode() const
+{
+    return shuffleMode;
+}
+
+byte SimulatediPod::getRepeatMode() const
+{
+    return repeatMode;
+}
+
+bool SimulatediPod::isPolling() const
+{
+    return polling;
+}
+
+unsigned long SimulatediPod::getElapsedMillis() const
+{
+    return elapsedMillis;
+}
+
+unsigned long SimulatediPod::getButtons() const
+{
+    return buttons;
+}
+
+unsigned long SimulatediPod::getButtonPressCount() const
+{
+    return buttonPressCount;
+}
+
+unsigned long SimulatediPod::getCommandCount() const
+{
+    return commandCount;
+}
+
+unsigned long SimulatediPod::getBadCommandCount() const
+{
+    return badCommandCount + parser.getResyncCount();
+}
+
+unsigned long SimulatediPod::getResponseCount() const
+{
+    return responseCount;
+}
+
+unsigned long SimulatediPod::getCorruptedByteCount() const
+{
+    return corruptedByteCount;
+}
+
+size_t SimulatediPod::write(uint8_t b)
+{
+    return write(&b, 1);
+}
+
+size_t SimulatediPod::write(const uint8_t *buffer, size_t size)
+{
+    size_t remaining = size;
+    while (remaining > 0)
+    {
+        const size_t used = parser.feed(buffer, remaining);
+        buffer += used;
+        remaining -= used;
+        if (parser.frameReady())
+        {
+            processCommand(parser.frameData(), parser.frameLength());
+        }
+    }
+    return size;
+}
+
+int SimulatediPod::availableForWrite()
+{
+    // commands are dealt with as soon as they're written
+    return 4096;
+}
+
+int SimulatediPod::available()
+{
+    update();
+    return readyBytes.size();
+}
+
+int SimulatediPod::read()
+{
+    const int b = peek();
+    if (b >= 0)
+    {
+        readyBytes.pop_front();
+    }
+    return b;
+}
+
+int SimulatediPod::peek()
+{
+    if (readyBytes.empty())
+    {
+        update();
+        if (readyBytes.empty())
+        {
+            return -1;
+        }
+    }
+    return readyBytes.front();
+}
+
+void SimulatediPod::update()
+{
+    const unsigned long now = millis();
+
+    if (playing)
+    {
+        elapsedMillis += now - lastUpdateMillis;
+        while (playing && (elapsedMillis >= library.trackLengthMillis))
+        {
+            if (repeatMode == REPEAT_MODE_ONE_SONG)
+            {
+                elapsedMillis -= library.trackLengthMillis;
+            }
+            else
+            {
+                const unsigned long over = elapsedMillis - library.trackLengthMillis;
+                changeTrack(1);
+                elapsedMillis = playing ? over : 0;
+            }
+        }
+    }
+    lastUpdateMillis = now;
+
+    if (polling && (mode == MODE_ADVANCED_REMOTE) && (now - lastPollMillis >= POLLING_INTERVAL_MILLIS))
+    {
+        lastPollMillis = now;
+        byte params[5];
+        params[0] = POLLING_ELAPSED_TIME;
+        writeNumber(&params[1], elapsedMillis);
+        respond(CMD_POLLING_MODE + 1, params, sizeof(params));
+    }
+
+    // let through the responses whose time has come
+    const unsigned long nowMicros = micros();
+    while (!pendingResponses.empty() && ((long) (nowMicros - pendingResponses.front().dueMicros) >= 0))
+    {
+        const std::vector<byte> &bytes = pendingResponses.front().bytes;
+        readyBytes.insert(readyBytes.end(), bytes.begin(), bytes.end());
+        pendingResponses.pop_front();
+    }
+}
+
+void SimulatediPod::processCommand(const byte *pData, size_t length)
+{
+    ++commandCount;
+
+    if (length < 2)
+    {
+        ++badCommandCount;
+        return;
+    }
+
+    switch (pData[0])
+    {
+    case MODE_SWITCHING_MODE:
+        processModeSwitch(pData, length);
+        break;
+
+    case MODE_SIMPLE_REMOTE:
+        processSimpleRemote(pData, length);
+        break;
+
+    case MODE_ADVANCED_REMOTE:
+        processAdvancedRemote(pData, length);
+        break;
+
+    default:
+        ++badCommandCount;
+        break;
+    }
+}
+
+void SimulatediPod::processModeSwitch(const byte *pData, size_t length)
+{
+    if ((length == 3) && (pData[1] == 0x01) &&
+        ((pData[2] == MODE_SIMPLE_REMOTE) || (pData[2] == MODE_ADVANCED_REMOTE)))
+    {
+        mode = (Mode) pData[2];
+        if (mode != MODE_ADVANCED_REMOTE)
+        {
+            // polling only lasts as long as Advanced Remote mode does
+            polling = false;
+        }
+    }
+    else
+    {
+        ++badCommandCount;
+    }
+}
+
+void SimulatediPod::processSimpleRemote(const byte *pData, size_t length)
+{
+    if ((pData[1] != 0x00) || (length > 5))
+    {
+        ++badCommandCount;
+        return;
+    }
+
+    unsigned long newButtons = 0;
+    for (size_t i = 2; i < length; ++i)
+    {
+        newButtons |= ((unsigned long) pData[i]) << (8 * (i - 2));
+    }
+
+    // buttons only do something when they're first pressed
+    const unsigned long pressed = newButtons & ~buttons;
+    buttons = newButtons;
+    pressButtons(pressed);
+}
+
+void SimulatediPod::pressButtons(unsigned long pressed)
+{
+    for (unsigned long bits = pressed; bits; bits &= bits - 1)
+    {
+        ++buttonPressCount;
+    }
+
+    if (pressed & BUTTON_PLAY_PAUSE)
+    {
+        playbackControl(PLAYBACK_CONTROL_PLAY_PAUSE);
+    }
+    if (pressed & BUTTON_JUST_PLAY)
+    {
+        playing = true;
+    }
+    if (pressed & BUTTON_JUST_PAUSE)
+    {
+        playing = false;
+    }
+    if (pressed & BUTTON_STOP)
+    {
+        playbackControl(PLAYBACK_CONTROL_STOP);
+    }
+    if (pressed & BUTTON_SKIP_FORWARD)
+    {
+        playbackControl(PLAYBACK_CONTROL_SKIP_FORWARD);
+    }
+    if (pressed & BUTTON_SKIP_BACKWARD)
+    {
+        playbackControl(PLAYBACK_CONTROL_SKIP_BACKWARD);
+    }
+    if (pressed & BUTTON_TOGGLE_SHUFFLE)
+    {
+        shuffleMode = shuffleMode ? 0 : 1;
+    }
+    if (pressed & BUTTON_TOGGLE_REPEAT)
+    {
+        repeatMode = (repeatMode + 1) % 3;
+    }
+}
+
+void SimulatediPod::processAdvancedRemote(const byte *pData, size_t length)
+{
+    if ((mode != MODE_ADVANCED_REMOTE) || (length < 3) || (pData[1] != 0x00))
+    {
+        ++badCommandCount;
+        return;
+    }
+
+    const byte command = pData[2];
+    const byte *pParams = &pData[3];
+    const size_t paramsLength = length - 3;
+
+    // the number of parameter bytes each command needs
+    size_t needed = 0;
+    switch (command)
+    {
+    case CMD_GET_ITEM_COUNT:
+    case CMD_POLLING_MODE:
+    case CMD_PLAYBACK_CONTROL:
+    case CMD_SET_SHUFFLE_MODE:
+    case CMD_SET_REPEAT_MODE:
+        needed = 1;
+        break;
+
+    case CMD_GET_TITLE:
+    case CMD_GET_ARTIST:
+    case CMD_GET_ALBUM:
+    case CMD_EXECUTE_SWITCH:
+    case CMD_JUMP_TO_SONG_IN_CURRENT_PLAYLIST:
+        needed = 4;
+        break;
+
+    case CMD_SWITCH_TO_ITEM:
+        needed = 5;
+        break;
+
+    case CMD_GET_ITEM_NAMES:
+        needed = 9;
+        break;
+    }
+
+    if (paramsLength < needed)
+    {
+        ++badCommandCount;
+        sendFeedback(FEEDBACK_INVALID_PARAM, command);
+        return;
+    }
+
+    const unsigned long songCount = playlistSongCount(currentPlaylist);
+
+    switch (command)
+    {
+    case CMD_GET_IPOD_NAME:
+        respondWithString(command + 1, "Simulated iPod");
+        break;
+
+    case CMD_SWITCH_TO_MAIN_LIBRARY_PLAYLIST:
+        selectedPlaylist = 0;
+        sendFeedback(FEEDBACK_SUCCESS, command);
+        break;
+
+    case CMD_SWITCH_TO_ITEM:
+    {
+        const unsigned long index = readNumber(&pParams[1]);
+        if (index >= itemCount(pParams[0]))
+        {
+            sendFeedback(FEEDBACK_INVALID_PARAM, command);
+            break;
+        }
+        if (pParams[0] == ITEM_PLAYLIST)
+        {
+            selectedPlaylist = index;
+        }
+        sendFeedback(FEEDBACK_SUCCESS, command);
+        break;
+    }
+
+    case CMD_GET_ITEM_COUNT:
+        if ((pParams[0] < ITEM_PLAYLIST) || (pParams[0] > ITEM_COMPOSER))
+        {
+            sendFeedback(FEEDBACK_INVALID_PARAM, command);
+            break;
+        }
+        respondWithNumber(command + 1, itemCount(pParams[0]));
+        break;
+
+    case CMD_GET_ITEM_NAMES:
+    {
+        const byte itemType = pParams[0];
+        const unsigned long offset = readNumber(&pParams[1]);
+        const unsigned long count = readNumber(&pParams[5]);
+        const unsigned long total = itemCount(itemType);
+        if ((offset >= total) || (count > total - offset))
+        {
+            sendFeedback(FEEDBACK_INVALID_PARAM, command);
+            break;
+        }
+
+        byte response[4 + 64];
+        for (unsigned long i = 0; i < count; ++i)
+        {
+            writeNumber(response, offset + i);
+            const size_t nameLength = itemName(itemType, offset + i, (char *) &response[4], sizeof(response) - 4);
+            respond(command + 1, response, 4 + nameLength + 1);
+        }
+        break;
+    }
+
+    case CMD_GET_TIME_AND_STATUS_INFO:
+    {
+        byte response[9];
+        writeNumber(&response[0], library.trackLengthMillis);
+        writeNumber(&response[4], elapsedMillis);
+        response[8] = playing ? STATUS_PLAYING : (elapsedMillis ? STATUS_PAUSED : STATUS_STOPPED);
+        respond(command + 1, response, sizeof(response));
+        break;
+    }
+
+    case CMD_GET_PLAYLIST_POSITION:
+        respondWithNumber(command + 1, playlistPosition);
+        break;
+
+    case CMD_GET_TITLE:
+    case CMD_GET_ARTIST:
+    case CMD_GET_ALBUM:
+    {
+        const unsigned long index = readNumber(pParams);
+        if (index >= songCount)
+        {
+            sendFeedback(FEEDBACK_INVALID_PARAM, command);
+            break;
+        }
+
+        const unsigned long song = songAt(index);
+        char name[64];
+        if (command == CMD_GET_TITLE)
+        {
+            itemName(ITEM_SONG, song, name, sizeof(name));
+        }
+        else if (command == CMD_GET_ARTIST)
+        {
+            itemName(ITEM_ARTIST, song % library.artistCount, name, sizeof(name));
+        }
+        else
+        {
+            itemName(ITEM_ALBUM, song % library.albumCount, name, sizeof(name));
+        }
+        respondWithString(command + 1, name);
+        break;
+    }
+
+    case CMD_POLLING_MODE:
+        polling = (pParams[0] != 0);
+        lastPollMillis = millis();
+        sendFeedback(FEEDBACK_SUCCESS, command);
+        break;
+
+    case CMD_EXECUTE_SWITCH:
+    {
+        const unsigned long index = readNumber(pParams);
+        const unsigned long newSongCount = playlistSongCount(selectedPlaylist);
+        if ((index != 0xFFFFFFFF) && (index >= newSongCount))
+        {
+            sendFeedback(FEEDBACK_INVALID_PARAM, command);
+            break;
+        }
+        currentPlaylist = selectedPlaylist;
+        playlistPosition = (index == 0xFFFFFFFF) ? 0 : index;
+        elapsedMillis = 0;
+        playing = (newSongCount > 0);
+        sendFeedback(FEEDBACK_SUCCESS, command);
+        break;
+    }
+
+    case CMD_PLAYBACK_CONTROL:
+        if ((pParams[0] < PLAYBACK_CONTROL_PLAY_PAUSE) || (pParams[0] > PLAYBACK_CONTROL_STOP_FF_OR_REV))
+        {
+            sendFeedback(FEEDBACK_INVALID_PARAM, command);
+            break;
+        }
+        playbackControl(pParams[0]);
+        sendFeedback(FEEDBACK_SUCCESS, command);
+        break;
+
+    case CMD_GET_SHUFFLE_MODE:
+        respond(command + 1, &shuffleMode, 1);
+        break;
+
+    case CMD_SET_SHUFFLE_MODE:
+        shuffleMode = pParams[0];
+        sendFeedback(FEEDBACK_SUCCESS, command);
+        break;
+
+    case CMD_GET_REPEAT_MODE:
+        respond(command + 1, &repeatMode, 1);
+        break;
+
+    case CMD_SET_REPEAT_MODE:
+        repeatMode = pParams[0];
+        sendFeedback(FEEDBACK_SUCCESS, command);
+        break;
+
+    case CMD_GET_SONG_COUNT_IN_CURRENT_PLAYLIST:
+        respondWithNumber(command + 1, songCount);
+        break;
+
+    case CMD_JUMP_TO_SONG_IN_CURRENT_PLAYLIST:
+    {
+        const unsigned long index = readNumber(pParams);
+        if (index >= songCount)
+        {
+            sendFeedback(FEEDBACK_INVALID_PARAM, command);
+            break;
+        }
+        playlistPosition = index;
+        elapsedMillis = 0;
+        playing = true;
+        sendFeedback(FEEDBACK_SUCCESS, command);
+        break;
+    }
+
+    default:
+        ++badCommandCount;
+        sendFeedback(FEEDBACK_FAILURE, command);
+        break;
+    }
+}
+
+void SimulatediPod::playbackControl(byte command)
+{
+    switch (command)
+    {
+    case PLAYBACK_CONTROL_PLAY_PAUSE:
+        playing = !playing && (playlistSongCount(currentPlaylist) > 0);
+        break;
+
+    case PLAYBACK_CONTROL_STOP:
+        playing = false;
+        elapsedMillis = 0;
+        break;
+
+    case PLAYBACK_CONTROL_SKIP_FORWARD:
+        changeTrack(1);
+        break;
+
+    case PLAYBACK_CONTROL_SKIP_BACKWARD:
+        if (elapsedMillis > RESTART_TRACK_MILLIS)
+        {
+            elapsedMillis = 0;
+        }
+        else
+        {
+            changeTrack(-1);
+        }
+        break;
+
+    default:
+        // fast forward and rewind aren't simulated
+        break;
+    }
+}
+
+void SimulatediPod::changeTrack(long step)
+{
+    const unsigned long songCount = playlistSongCount(currentPlaylist);
+    if (songCount == 0)
+    {
+        playing = false;
+        return;
+    }
+
+    long position = (long) playlistPosition + step;
+    if (position < 0)
+    {
+        position = 0;
+    }
+    else if ((unsigned long) position >= songCount)
+    {
+        position = 0;
+        if (repeatMode != REPEAT_MODE_ALL_SONGS)
+        {
+            // fell off the end of the playlist
+            playing = false;
+        }
+    }
+
+    playlistPosition = position;
+    elapsedMillis = 0;
+
+    if (polling && (mode == MODE_ADVANCED_REMOTE))
+    {
+        byte params[5];
+        params[0] = POLLING_TRACK_CHANGE;
+        writeNumber(&params[1], playlistPosition);
+        respond(CMD_POLLING_MODE + 1, params, sizeof(params));
+    }
+}
+
+unsigned long SimulatediPod::itemCount(byte itemType) const
+{
+    switch (itemType)
+    {
+    case ITEM_PLAYLIST:
+        return library.playlistCount;
+    case ITEM_ARTIST:
+        return library.artistCount;
+    case ITEM_ALBUM:
+        return library.albumCount;
+    case ITEM_GENRE:
+        return library.genreCount;
+    case ITEM_SONG:
+        return library.songCount;
+    case ITEM_COMPOSER:
+        return library.composerCount;
+    default:
+        return 0;
+    }
+}
+
+unsigned long SimulatediPod::playlistSongCount(unsigned long playlist) const
+{
+    if ((playlist == 0) || (library.songCount == 0))
+    {
+        return library.songCount;
+    }
+
+    // anywhere from 1 to 200 songs, but always the same for a given playlist
+    const unsigned long count = 1 + ((playlist * 2654435761UL) & 0xFFFFFFFFUL) % 200;
+    return (count < library.songCount) ? count : library.songCount;
+}
+
+unsigned long SimulatediPod::songAt(unsigned long position) const
+{
+    if (currentPlaylist == 0)
+    {
+        return position;
+    }
+    return (currentPlaylist * 7919UL + position * 104729UL) % library.songCount;
+}
+
+size_t SimulatediPod::itemName(byte itemType, unsigned long index, char *pName, size_t size)
+{
+    static const char *TYPE_NAME[] =
+    {
+        "Item", "Playlist", "Artist", "Album", "Genre", "Song", "Composer"
+    };
+
+    int length;
+    if ((itemType == ITEM_PLAYLIST) && (index == 0))
+    {
+        // playlist 0 is the whole library, and is named after the iPod
+        length = snprintf(pName, size, "Simulated iPod");
+    }
+    else
+    {
+        const char *typeName = (itemType <= ITEM_COMPOSER) ? TYPE_NAME[itemType] : TYPE_NAME[0];
+        length = snprintf(pName, size, "%s %lu", typeName, index);
+    }
+    return ((size_t) length < size) ? length : size - 1;
+}
+
+void SimulatediPod::respond(byte command, const byte *pParams, size_t paramsLength)
+{
+    std::vector<byte> data(3 + paramsLength);
+    data[0] = MODE_ADVANCED_REMOTE;
+    data[1] = 0x00;
+    data[2] = command;
+    if (paramsLength)
+    {
+        memcpy(&data[3], pParams, paramsLength);
+    }
+    sendFrame(&data[0], data.size());
+}
+
+void SimulatediPod::respondWithNumber(byte command, unsigned long number)
+{
+    byte params[4];
+    writeNumber(params, number);
+    respond(command, params, sizeof(params));
+}
+
+void SimulatediPod::respondWithString(byte command, const char *pString)
+{
+    // strings go with their terminating NUL
+    respond(command, (const byte *) pString, strlen(pString) + 1);
+}
+
+void SimulatediPod::sendFeedback(byte result, byte command)
+{
+    const byte params[3] = { result, 0x00, command };
+    respond(RESPONSE_FEEDBACK, params, sizeof(params));
+}
+
+void SimulatediPod::sendFrame(const byte *pData, size_t length)
+{
+    pendingResponses.push_back(PendingResponse());
+    PendingResponse &response = pendingResponses.back();
+    response.dueMicros = micros() + responseDelayMicros;
+
+    std::vector<byte> &bytes = response.bytes;
+    bytes.reserve(2 + 3 + length + 1);
+    bytes.push_back((byte) AAPFrameParser::HEADER1);
+    bytes.push_back((byte) AAPFrameParser::HEADER2);
+    if (length <= 0xFF)
+    {
+        bytes.push_back(length);
+    }
+    else
+    {
+        bytes.push_back((byte) AAPFrameParser::LARGE_PACKET_MARKER);
+        bytes.push_back(length >> 8);
+        bytes.push_back(length & 0xFF);
+    }
+    bytes.insert(bytes.end(), pData, pData + length);
+
+    byte checksum = 0;
+    for (size_t i = 2; i < bytes.size(); ++i)
+    {
+        checksum += bytes[i];
+    }
+    bytes.push_back(0x100 - checksum);
+
+    if (byteErrorRate > 0)
+    {
+        for (size_t i = 0; i < bytes.size(); ++i)
+        {
+            if (nextRandom() < byteErrorRate * 4294967296.0)
+            {
+                bytes[i] ^= 1 << (nextRandom() % 8);
+                ++corruptedByteCount;
+            }
+        }
+    }
+
+    ++responseCount;
+}
+
+unsigned long SimulatediPod::nextRandom()
+{
+    // xorshift32: quick, and the same sequence for the same seed everywhere
+    unsigned long x = randomState;
+    x ^= (x << 13) & 0xFFFFFFFFUL;
+    x ^= x >> 17;
+    x ^= (x << 5) & 0xFFFFFFFFUL;
+    randomState = x;
+    return x;
+}
+
+unsigned long SimulatediPod::readNumber(const byte *p)
+{
+    return (((unsigned long) p[0]) << 24) |
+           (((unsigned long) p[1]) << 16) |
+           (((unsigned long) p[2]) << 8) |
+           p[3];
+}
+
+void SimulatediPod::writeNumber(byte *p, unsigned long n)
+{
+    p[0] = n >> 24;
+    p[1] = n >> 16;
+    p[2] = n >> 8;
+    p[3] = n;
+}
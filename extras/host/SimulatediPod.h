@@ -0,0 +1,200 @@
+#ifndef SIMULATED_IPOD_H
+#define SIMULATED_IPOD_H
+/*******************************************************************************
+ * Copyright (c) 2009 David Findlay
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *    - Redistributions of source code must retain the above copyright notice,
+ *      this list of conditions and the following disclaimer.
+ *    - Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ ******************************************************************************/
+
+#include "Arduino.h"
+#include "AAPFrameParser.h"
+
+#include <deque>
+#include <vector>
+
+/**
+ * A pretend iPod, for testing and benchmarking the library on a PC with no
+ * hardware attached. It's a Stream, so you hand it to setSerial() in place
+ * of the serial port the real iPod would be on: whatever the library writes
+ * is parsed as commands, and the responses come back through available()
+ * and read().
+ *
+ * It understands the mode switching commands, the Simple Remote (Mode 2)
+ * buttons and the Advanced Remote (Mode 4) commands that AdvancedRemote
+ * sends, and answers from a synthetic library whose size you choose: songs
+ * are called "Song 0", "Song 1" and so on, and likewise for the other item
+ * types. Playlist 0 is the main library playlist with every song in it.
+ * Playback advances in real time (i.e. with millis()), and polling mode
+ * sends the elapsed time every 500ms and a notification on track changes.
+ *
+ * To see how the library copes with a less than perfect link, responses
+ * can be held back for a while before they become readable, and bytes can
+ * be corrupted at random. The randomness comes from a seeded generator, so
+ * a run can be repeated exactly.
+ */
+class SimulatediPod : public Stream
+{
+public: // enums
+    enum Mode
+    {
+        MODE_SIMPLE_REMOTE = 0x02,
+        MODE_ADVANCED_REMOTE = 0x04
+    };
+
+public: // types
+    struct Library
+    {
+        unsigned long songCount;
+        unsigned long playlistCount;   // including the main library playlist
+        unsigned long artistCount;
+        unsigned long albumCount;
+        unsigned long genreCount;
+        unsigned long composerCount;
+        unsigned long trackLengthMillis;
+    };
+
+public: // methods
+    SimulatediPod();
+
+    /**
+     * The synthetic library to answer from. The default is a modest one;
+     * use something like 50000 songs and 2000 playlists for load testing.
+     */
+    void setLibrary(const Library &library);
+    const Library &getLibrary() const;
+
+    /**
+     * How long after a command its response becomes readable.
+     */
+    void setResponseDelayMicros(unsigned long delayMicros);
+
+    /**
+     * The chance (0 to 1) of each byte sent to the accessory having a bit
+     * flipped, and the seed for the random number generator behind it.
+     */
+    void setByteErrorRate(double rate, unsigned long seed = 1);
+
+    /**
+     * What the simulation looks like from the iPod's side, for checking
+     * that commands had the effect they should.
+     */
+    Mode getMode() const;
+    bool isPlaying() const;
+    unsigned long getCurrentPlaylist() const;
+    unsigned long getPlaylistPosition() const;
+    byte getShuffleMode() const;
+    byte getRepeatMode() const;
+    bool isPolling() const;
+    unsigned long getElapsedMillis() const;
+
+    /**
+     * The buttons the Simple Remote is currently holding down, as the
+     * bits after the mode and command bytes (first button byte in the
+     * least significant bits), and how many presses there have been.
+     */
+    unsigned long getButtons() const;
+    unsigned long getButtonPressCount() const;
+
+    unsigned long getCommandCount() const;
+    unsigned long getBadCommandCount() const;
+    unsigned long getResponseCount() const;
+    unsigned long getCorruptedByteCount() const;
+
+    /**
+     * The Stream interface the library talks to.
+     */
+    virtual size_t write(uint8_t b);
+    virtual size_t write(const uint8_t *buffer, size_t size);
+    virtual int availableForWrite();
+    virtual int available();
+    virtual int read();
+    virtual int peek();
+
+private: // types
+    struct PendingResponse
+    {
+        unsigned long dueMicros;
+        std::vector<byte> bytes;
+    };
+
+private: // attributes
+    static const size_t MAX_COMMAND_SIZE = 255;
+    static const unsigned long POLLING_INTERVAL_MILLIS = 500;
+
+    byte commandBuffer[MAX_COMMAND_SIZE + 1];
+    AAPFrameParser parser;
+
+    Library library;
+    unsigned long responseDelayMicros;
+    double byteErrorRate;
+    unsigned long randomState;
+
+    std::deque<PendingResponse> pendingResponses;
+    std::deque<byte> readyBytes;
+
+    Mode mode;
+    unsigned long currentPlaylist;
+    unsigned long selectedPlaylist;
+    unsigned long playlistPosition;
+    bool playing;
+    unsigned long elapsedMillis;
+    unsigned long lastUpdateMillis;
+    byte shuffleMode;
+    byte repeatMode;
+    bool polling;
+    unsigned long lastPollMillis;
+
+    unsigned long buttons;
+    unsigned long buttonPressCount;
+
+    unsigned long commandCount;
+    unsigned long badCommandCount;
+    unsigned long responseCount;
+    unsigned long corruptedByteCount;
+
+private: // methods
+    void update();
+    void processCommand(const byte *pData, size_t length);
+    void processModeSwitch(const byte *pData, size_t length);
+    void processSimpleRemote(const byte *pData, size_t length);
+    void processAdvancedRemote(const byte *pData, size_t length);
+    void pressButtons(unsigned long pressed);
+    void playbackControl(byte command);
+    void changeTrack(long step);
+
+    unsigned long itemCount(byte itemType) const;
+    unsigned long playlistSongCount(unsigned long playlist) const;
+    unsigned long songAt(unsigned long position) const;
+    static size_t itemName(byte itemType, unsigned long index, char *pName, size_t size);
+
+    void respond(byte command, const byte *pParams, size_t paramsLength);
+    void respondWithNumber(byte command, unsigned long number);
+    void respondWithString(byte command, const char *pString);
+    void sendFeedback(byte result, byte command);
+    void sendFrame(const byte *pData, size_t length);
+    unsigned long nextRandom();
+
+    static unsigned long readNumber(const byte *p);
+    static void writeNumber(byte *p, unsigned long n);
+};
+
+#endif // SIMULATED_IPOD_H
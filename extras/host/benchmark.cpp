@@ -0,0 +1,539 @@
+/*******************************************************************************
+ * Copyright (c) 2009 David Findlay
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *    - Redistributions of source code must retain the above copyright notice,
+ *      this list of conditions and the following disclaimer.
+ *    - Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ ******************************************************************************/
+
+// Microbenchmarks for the library's receive and transmit paths:
+//
+//   - parsing throughput through loop() (and so receive()), in MB/s
+//     and frames/s, for a clean stream and one with noise in it, and in
+//     MB/s for the clean stream with no handlers set, which is skipped
+//   - the cost per frame of each Advanced Remote response type, parsed and
+//     dispatched to its handler, and for the ones with strings, with the
+//     handler that's given the length too (the /view results)
+//   - the cost of sendCommand with each shape of parameters AdvancedRemote
+//     uses, and of each SimpleRemote::send* method, writing to a serial
+//     port that's always ready
+//
+//   benchmark [--output results.json] [--thresholds limits.txt]
+//
+// Results are printed as a table and, with --output, written as JSON. With
+// --thresholds, each line of the file names a result and the worst value
+// it's allowed (a minimum for throughputs, a maximum for costs), and the
+// benchmark fails if any result is worse or missing. The thresholds that
+// come with the library are deliberately loose, to catch big regressions
+// on any reasonable machine; tighten them for your own build box.
+
+#include "AdvancedRemote.h"
+#include "SimpleRemote.h"
+
+#include <chrono>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+namespace
+{
+    typedef std::chrono::steady_clock Clock;
+
+    // each measurement is the best of this many runs
+    const int RUNS = 5;
+
+    struct Result
+    {
+        std::string name;
+        double value;
+        const char *unit;
+        bool higherIsBetter;
+    };
+
+    std::vector<Result> results;
+
+    void addResult(const std::string &name, double value, const char *unit, bool higherIsBetter)
+    {
+        Result result = { name, value, unit, higherIsBetter };
+        results.push_back(result);
+        printf("%-56s %14.2f %s\n", name.c_str(), value, unit);
+    }
+
+    // plays back a buffer of bytes as if they had arrived from the iPod
+    class ByteSource : public Stream
+    {
+    public:
+        ByteSource() : pos(0) {}
+
+        std::vector<byte> bytes;
+        size_t pos;
+
+        void rewind() { pos = 0; }
+
+        virtual size_t write(uint8_t) { return 1; }
+        virtual int available() { return bytes.size() - pos; }
+        virtual int read() { return (pos < bytes.size()) ? bytes[pos++] : -1; }
+        virtual int peek() { return (pos < bytes.size()) ? bytes[pos] : -1; }
+    };
+
+    // a serial port that takes everything straight away
+    class NullSink : public Stream
+    {
+    public:
+        NullSink() : count(0) {}
+
+        unsigned long count;
+
+        virtual size_t write(uint8_t) { ++count; return 1; }
+        virtual size_t write(const uint8_t *, size_t size) { count += size; return size; }
+        virtual int availableForWrite() { return 4096; }
+        virtual int available() { return 0; }
+        virtual int read() { return -1; }
+        virtual int peek() { return -1; }
+    };
+
+    // gets at the protected command-sending methods
+    class CommandSender : public iPodSerialT<CommandSender>
+    {
+    public:
+        using iPodSerial::sendCommandWithLength;
+        using iPodSerialT<CommandSender>::sendCommand;
+    };
+
+    unsigned long handled;
+    unsigned long stringBytes;
+
+    // the string handlers do what a sketch would have to: find the length
+    void feedbackHandler(AdvancedRemote::Feedback, byte) { ++handled; }
+    void stringHandler(const char *s) { ++handled; stringBytes += strlen(s); }
+    void stringViewHandler(const char *, size_t length, bool) { ++handled; stringBytes += length; }
+    void numberHandler(unsigned long) { ++handled; }
+    void itemNameHandler(unsigned long, const char *s) { ++handled; stringBytes += strlen(s); }
+    void itemNameViewHandler(unsigned long, const char *, size_t length, bool) { ++handled; stringBytes += length; }
+    void timeAndStatusHandler(unsigned long, unsigned long, AdvancedRemote::PlaybackStatus) { ++handled; }
+    void pollingHandler(AdvancedRemote::PollingCommand, unsigned long) { ++handled; }
+    void shuffleModeHandler(AdvancedRemote::ShuffleMode) { ++handled; }
+    void repeatModeHandler(AdvancedRemote::RepeatMode) { ++handled; }
+
+    void setHandlers(AdvancedRemote &advancedRemote, bool stringViews = false)
+    {
+        advancedRemote.setFeedbackHandler(feedbackHandler);
+        advancedRemote.setItemCountHandler(numberHandler);
+        advancedRemote.setTimeAndStatusHandler(timeAndStatusHandler);
+        advancedRemote.setPlaylistPositionHandler(numberHandler);
+        if (stringViews)
+        {
+            advancedRemote.setiPodNameHandler(stringViewHandler);
+            advancedRemote.setItemNameHandler(itemNameViewHandler);
+            advancedRemote.setTitleHandler(stringViewHandler);
+            advancedRemote.setArtistHandler(stringViewHandler);
+            advancedRemote.setAlbumHandler(stringViewHandler);
+        }
+        else
+        {
+            advancedRemote.setiPodNameHandler(stringHandler);
+            advancedRemote.setItemNameHandler(itemNameHandler);
+            advancedRemote.setTitleHandler(stringHandler);
+            advancedRemote.setArtistHandler(stringHandler);
+            advancedRemote.setAlbumHandler(stringHandler);
+        }
+        advancedRemote.setPollingHandler(pollingHandler);
+        advancedRemote.setShuffleModeHandler(shuffleModeHandler);
+        advancedRemote.setRepeatModeHandler(repeatModeHandler);
+        advancedRemote.setCurrentPlaylistSongCountHandler(numberHandler);
+    }
+
+    void appendFrame(std::vector<byte> &bytes, const byte *pData, size_t length)
+    {
+        bytes.push_back(0xFF);
+        bytes.push_back(0x55);
+        bytes.push_back(length);
+        byte checksum = length;
+        for (size_t i = 0; i < length; ++i)
+        {
+            bytes.push_back(pData[i]);
+            checksum += pData[i];
+        }
+        bytes.push_back(0x100 - checksum);
+    }
+
+    struct ResponseType
+    {
+        const char *name;
+        byte length;
+        byte data[24];
+        bool hasString;
+    };
+
+    // one of each Advanced Remote response, as the iPod would send them
+    const ResponseType RESPONSE_TYPES[] =
+    {
+        { "feedback",           6,  { 0x04, 0x00, 0x01, 0x00, 0x00, 0x29 }, false },
+        { "ipod_name",          14, { 0x04, 0x00, 0x15, 'D', 'a', 'v', 'e', '\'', 's', ' ', 'i', 'P', 'o', 0 }, true },
+        { "item_count",         7,  { 0x04, 0x00, 0x19, 0x00, 0x00, 0xC3, 0x50 }, false },
+        { "item_name",          17, { 0x04, 0x00, 0x1B, 0x00, 0x00, 0x01, 0x2C, 'S', 'o', 'n', 'g', ' ', '3', '0', '0', 0, 0 }, true },
+        { "time_and_status",    12, { 0x04, 0x00, 0x1D, 0x00, 0x03, 0x0D, 0x40, 0x00, 0x00, 0x75, 0x30, 0x01 }, false },
+        { "playlist_position",  7,  { 0x04, 0x00, 0x1F, 0x00, 0x00, 0x00, 0x2A }, false },
+        { "title",              18, { 0x04, 0x00, 0x21, 'B', 'o', 'h', 'e', 'm', 'i', 'a', 'n', ' ', 'R', 'h', 'a', 'p', 's', 0 }, true },
+        { "artist",             9,  { 0x04, 0x00, 0x23, 'Q', 'u', 'e', 'e', 'n', 0 }, true },
+        { "album",              20, { 0x04, 0x00, 0x25, 'A', ' ', 'N', 'i', 'g', 'h', 't', ' ', 'a', 't', ' ', 't', 'h', 'e', ' ', 'O', 0 }, true },
+        { "polling",            8,  { 0x04, 0x00, 0x27, 0x04, 0x00, 0x00, 0x75, 0x30 }, false },
+        { "shuffle_mode",       4,  { 0x04, 0x00, 0x2D, 0x01 }, false },
+        { "repeat_mode",        4,  { 0x04, 0x00, 0x30, 0x02 }, false },
+        { "song_count",         7,  { 0x04, 0x00, 0x36, 0x00, 0x00, 0x00, 0x64 }, false },
+    };
+
+    const size_t RESPONSE_TYPE_COUNT = sizeof(RESPONSE_TYPES) / sizeof(RESPONSE_TYPES[0]);
+
+    // runs the function the given number of times, RUNS times over, and
+    // returns the best time in nanoseconds for a single go
+    template <typename Function>
+    double bestNanos(Function function, unsigned long iterations)
+    {
+        double best = 0;
+        for (int run = 0; run < RUNS; ++run)
+        {
+            const Clock::time_point start = Clock::now();
+            for (unsigned long i = 0; i < iterations; ++i)
+            {
+                function();
+            }
+            const double nanos = std::chrono::duration<double, std::nano>(Clock::now() - start).count() / iterations;
+            if ((run == 0) || (nanos < best))
+            {
+                best = nanos;
+            }
+        }
+        return best;
+    }
+
+    void benchmarkParsing(const char *name, const ByteSource &stream, bool withHandlers = true)
+    {
+        const unsigned long PASSES = 20;
+
+        AdvancedRemote advancedRemote;
+        if (withHandlers)
+        {
+            setHandlers(advancedRemote);
+        }
+        ByteSource source(stream);
+        advancedRemote.setSerial(source);
+
+        handled = 0;
+        const double nanos = bestNanos([&]()
+        {
+            source.rewind();
+            while (source.available())
+            {
+                advancedRemote.loop();
+            }
+        }, PASSES);
+
+        addResult(std::string("parse/") + name + "/throughput", source.bytes.size() * 1e3 / nanos, "MB/s", true);
+        if (withHandlers)
+        {
+            // only count the frames that made it through the noise
+            const double frames = (double) handled / (PASSES * RUNS);
+            addResult(std::string("parse/") + name + "/frames", frames * 1e9 / nanos, "frames/s", true);
+        }
+    }
+
+    void benchmarkParsing()
+    {
+        const unsigned long FRAMES = 20000;
+        ByteSource clean;
+        for (unsigned long i = 0; i < FRAMES; ++i)
+        {
+            const ResponseType &type = RESPONSE_TYPES[i % RESPONSE_TYPE_COUNT];
+            appendFrame(clean.bytes, type.data, type.length);
+        }
+        benchmarkParsing("clean", clean);
+        // the same frames with no handlers set, so they're all skipped
+        benchmarkParsing("unwanted", clean, false);
+
+        // a couple of bytes of noise between 1 in 25 frames, and 1 frame in
+        // 100 with a bit flipped, from a fixed seed so every run is the same
+        ByteSource noisy;
+        unsigned long seed = 12345;
+        for (unsigned long i = 0; i < FRAMES; ++i)
+        {
+            seed = seed * 1103515245UL + 12345UL;
+            const unsigned long r = (seed >> 16) & 0x7FFF;
+
+            const ResponseType &type = RESPONSE_TYPES[i % RESPONSE_TYPE_COUNT];
+            const size_t start = noisy.bytes.size();
+            appendFrame(noisy.bytes, type.data, type.length);
+            if (r % 100 == 0)
+            {
+                noisy.bytes[start + 3 + r % type.length] ^= 0x10;
+            }
+            if (r % 25 == 1)
+            {
+                noisy.bytes.push_back(r & 0xFF);
+                noisy.bytes.push_back((r >> 7) & 0xFF);
+            }
+        }
+        benchmarkParsing("noisy", noisy);
+    }
+
+    void benchmarkDispatch(bool stringViews)
+    {
+        const unsigned long FRAMES = 1000;
+
+        for (size_t t = 0; t < RESPONSE_TYPE_COUNT; ++t)
+        {
+            const ResponseType &type = RESPONSE_TYPES[t];
+            if (stringViews && !type.hasString)
+            {
+                continue;
+            }
+
+            AdvancedRemote advancedRemote;
+            setHandlers(advancedRemote, stringViews);
+            ByteSource source;
+            for (unsigned long i = 0; i < FRAMES; ++i)
+            {
+                appendFrame(source.bytes, type.data, type.length);
+            }
+            advancedRemote.setSerial(source);
+
+            handled = 0;
+            const double nanos = bestNanos([&]()
+            {
+                source.rewind();
+                while (source.available())
+                {
+                    advancedRemote.loop();
+                }
+            }, 20);
+
+            if (handled != FRAMES * 20 * RUNS)
+            {
+                fprintf(stderr, "%s: expected %lu handler calls, got %lu\n", type.name, FRAMES * 20 * RUNS, handled);
+                exit(2);
+            }
+            addResult(std::string("dispatch/") + type.name + (stringViews ? "/view" : ""), nanos / FRAMES, "ns/frame", false);
+        }
+    }
+
+    void benchmarkSending()
+    {
+        const unsigned long ITERATIONS = 200000;
+        NullSink sink;
+
+        CommandSender sender;
+        sender.setSerial(sink);
+        static const byte command[] = { 0x04, 0x00, 0x29, 0x01 };
+
+        addResult("send/sendCommandWithLength", bestNanos([&]()
+        {
+            sender.sendCommandWithLength(sizeof(command), command);
+        }, ITERATIONS), "ns/call", false);
+        addResult("send/sendCommand", bestNanos([&]()
+        {
+            sender.sendCommand(0x04, 0x00, 0x14);
+        }, ITERATIONS), "ns/call", false);
+        addResult("send/sendCommand/byte", bestNanos([&]()
+        {
+            sender.sendCommand(0x04, 0x00, 0x29, (byte) 0x01);
+        }, ITERATIONS), "ns/call", false);
+        addResult("send/sendCommand/number", bestNanos([&]()
+        {
+            sender.sendCommand(0x04, 0x00, 0x20, 12345UL);
+        }, ITERATIONS), "ns/call", false);
+        addResult("send/sendCommand/byte_number", bestNanos([&]()
+        {
+            sender.sendCommand(0x04, 0x00, 0x17, (byte) 0x01, 12345UL);
+        }, ITERATIONS), "ns/call", false);
+        addResult("send/sendCommand/byte_number_number", bestNanos([&]()
+        {
+            sender.sendCommand(0x04, 0x00, 0x1A, (byte) 0x05, 100UL, 200UL);
+        }, ITERATIONS), "ns/call", false);
+
+        SimpleRemote simpleRemote;
+        simpleRemote.setSerial(sink);
+
+        typedef bool (SimpleRemote::*Button)();
+        struct SimpleCommand
+        {
+            const char *name;
+            Button button;
+        };
+        static const SimpleCommand SIMPLE_COMMANDS[] =
+        {
+            { "sendButtonReleased", &SimpleRemote::sendButtonReleased },
+            { "sendPlay", &SimpleRemote::sendPlay },
+            { "sendVolPlus", &SimpleRemote::sendVolPlus },
+            { "sendVolMinus", &SimpleRemote::sendVolMinus },
+            { "sendSkipForward", &SimpleRemote::sendSkipForward },
+            { "sendSkipBackward", &SimpleRemote::sendSkipBackward },
+            { "sendNextAlbum", &SimpleRemote::sendNextAlbum },
+            { "sendPreviousAlbum", &SimpleRemote::sendPreviousAlbum },
+            { "sendStop", &SimpleRemote::sendStop },
+            { "sendJustPlay", &SimpleRemote::sendJustPlay },
+            { "sendJustPause", &SimpleRemote::sendJustPause },
+            { "sendToggleMute", &SimpleRemote::sendToggleMute },
+            { "sendNextPlaylist", &SimpleRemote::sendNextPlaylist },
+            { "sendPreviousPlaylist", &SimpleRemote::sendPreviousPlaylist },
+            { "sendToggleShuffle", &SimpleRemote::sendToggleShuffle },
+            { "sendToggleRepeat", &SimpleRemote::sendToggleRepeat },
+            { "sendiPodOff", &SimpleRemote::sendiPodOff },
+            { "sendiPodOn", &SimpleRemote::sendiPodOn },
+            { "sendMenuButton", &SimpleRemote::sendMenuButton },
+            { "sendOkSelectButton", &SimpleRemote::sendOkSelectButton },
+            { "sendScrollUp", &SimpleRemote::sendScrollUp },
+            { "sendScrollDown", &SimpleRemote::sendScrollDown },
+        };
+
+        for (size_t i = 0; i < sizeof(SIMPLE_COMMANDS) / sizeof(SIMPLE_COMMANDS[0]); ++i)
+        {
+            const Button button = SIMPLE_COMMANDS[i].button;
+            addResult(std::string("send/SimpleRemote::") + SIMPLE_COMMANDS[i].name, bestNanos([&]()
+            {
+                (simpleRemote.*button)();
+            }, ITERATIONS), "ns/call", false);
+        }
+
+        if (sink.count == 0)
+        {
+            fprintf(stderr, "nothing was sent\n");
+            exit(2);
+        }
+    }
+
+    bool writeResults(const char *pPath)
+    {
+        FILE *pFile = fopen(pPath, "w");
+        if (!pFile)
+        {
+            perror(pPath);
+            return false;
+        }
+
+        fprintf(pFile, "[\n");
+        for (size_t i = 0; i < results.size(); ++i)
+        {
+            const Result &result = results[i];
+            fprintf(pFile, "  {\"name\": \"%s\", \"value\": %.3f, \"unit\": \"%s\", \"better\": \"%s\"}%s\n",
+                    result.name.c_str(), result.value, result.unit,
+                    result.higherIsBetter ? "higher" : "lower",
+                    (i + 1 < results.size()) ? "," : "");
+        }
+        fprintf(pFile, "]\n");
+        fclose(pFile);
+        return true;
+    }
+
+    // returns the number of thresholds that weren't met, or -1 if the file couldn't be read
+    int checkThresholds(const char *pPath)
+    {
+        FILE *pFile = fopen(pPath, "r");
+        if (!pFile)
+        {
+            perror(pPath);
+            return -1;
+        }
+
+        int failures = 0;
+        char line[256];
+        while (fgets(line, sizeof(line), pFile))
+        {
+            char name[200];
+            double limit;
+            if ((line[0] == '#') || (sscanf(line, "%199s %lf", name, &limit) != 2))
+            {
+                continue;
+            }
+
+            const Result *pResult = 0;
+            for (size_t i = 0; i < results.size(); ++i)
+            {
+                if (results[i].name == name)
+                {
+                    pResult = &results[i];
+                }
+            }
+
+            if (!pResult)
+            {
+                printf("FAIL %s: no such result\n", name);
+                ++failures;
+            }
+            else if (pResult->higherIsBetter ? (pResult->value < limit) : (pResult->value > limit))
+            {
+                printf("FAIL %s: %.2f %s, limit %.2f\n", name, pResult->value, pResult->unit, limit);
+                ++failures;
+            }
+        }
+        fclose(pFile);
+        return failures;
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    const char *pOutputPath = 0;
+    const char *pThresholdsPath = 0;
+    for (int i = 1; i < argc; ++i)
+    {
+        if (!strcmp(argv[i], "--output") && (i + 1 < argc))
+        {
+            pOutputPath = argv[++i];
+        }
+        else if (!strcmp(argv[i], "--thresholds") && (i + 1 < argc))
+        {
+            pThresholdsPath = argv[++i];
+        }
+        else
+        {
+            fprintf(stderr, "usage: %s [--output results.json] [--thresholds limits.txt]\n", argv[0]);
+            return 2;
+        }
+    }
+
+    benchmarkParsing();
+    benchmarkDispatch(false);
+    benchmarkDispatch(true);
+    benchmarkSending();
+
+    if (pOutputPath && !writeResults(pOutputPath))
+    {
+        return 2;
+    }
+
+    if (pThresholdsPath)
+    {
+        const int failures = checkThresholds(pThresholdsPath);
+        if (failures < 0)
+        {
+            return 2;
+        }
+        if (failures > 0)
+        {
+            printf("%d threshold(s) not met\n", failures);
+            return 1;
+        }
+        printf("all thresholds met\n");
+    }
+
+    return 0;
+}
@@ -0,0 +1,463 @@
+/*******************************************************************************
+ * Copyright (c) 2009 David Findlay
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *    - Redistributions of source code must retain the above copyright notice,
+ *      this list of conditions and the following disclaimer.
+ *    - Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ ******************************************************************************/
+
+
+// Deterministic checks of how the library copes with damaged frames, for
+// the cases load_test's random byte errors are unlikely to hit:
+//
+//   - a truncated frame nobody wants, with a wanted frame starting inside it
+//   - a skipped frame with a bad checksum while a large-message handler is set
+//   - a streamed large packet that goes bad part way through
+//   - a title too long for the buffer, cut short for a string view handler
+//   - frames nobody wants while a request is waiting for its answer
+//   - random noise, fed to the parser in bulk and a byte at a time, with and
+//     without frames being skipped, giving the same frames every way
+//
+//   frame_checks
+//
+// Each check prints a line saying whether it passed, and the exit status
+// is 1 if any failed. make check builds and runs it.
+
+#include "AdvancedRemote.h"
+
+#include <deque>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+namespace
+{
+    // Stands in for the serial port: hands the library whatever bytes a
+    // check has queued up, and swallows anything the library sends.
+    class ByteStream : public Stream
+    {
+    public:
+        void push(const std::vector<byte> &bytes) { pending.insert(pending.end(), bytes.begin(), bytes.end()); }
+
+        virtual size_t write(uint8_t b)
+        {
+            (void) b;
+            return 1;
+        }
+
+        virtual int available() { return pending.size(); }
+
+        virtual int read()
+        {
+            if (pending.empty())
+            {
+                return -1;
+            }
+            const byte b = pending.front();
+            pending.pop_front();
+            return b;
+        }
+
+        virtual int peek() { return pending.empty() ? -1 : pending.front(); }
+
+    private:
+        std::deque<byte> pending;
+    };
+
+    std::vector<byte> frame(const std::vector<byte> &data)
+    {
+        std::vector<byte> bytes;
+        bytes.push_back(0xFF);
+        bytes.push_back(0x55);
+        if (data.size() > 255)
+        {
+            bytes.push_back(0x00);
+            bytes.push_back(data.size() >> 8);
+        }
+        bytes.push_back(data.size() & 0xFF);
+
+        byte checksum = 0;
+        for (size_t i = 2; i < bytes.size(); ++i)
+        {
+            checksum += bytes[i];
+        }
+        for (size_t i = 0; i < data.size(); ++i)
+        {
+            bytes.push_back(data[i]);
+            checksum += data[i];
+        }
+        bytes.push_back(0x100 - checksum);
+        return bytes;
+    }
+
+    std::vector<byte> titleFrame(const char *title)
+    {
+        std::vector<byte> data;
+        data.push_back(0x04);
+        data.push_back(0x00);
+        data.push_back(AdvancedRemote::CMD_GET_TITLE + 1);
+        data.insert(data.end(), title, title + strlen(title) + 1);
+        return frame(data);
+    }
+
+    std::vector<byte> pollingFrame()
+    {
+        const byte data[] = { 0x04, 0x00, AdvancedRemote::CMD_POLLING_MODE + 1, 0x04, 0x00, 0x00, 0x75, 0x30 };
+        return frame(std::vector<byte>(data, data + sizeof(data)));
+    }
+
+    std::vector<byte> largeFrame(size_t length)
+    {
+        std::vector<byte> data(length);
+        for (size_t i = 0; i < length; ++i)
+        {
+            data[i] = (byte) (i * 7);
+        }
+        return frame(data);
+    }
+
+    std::vector<std::string> titles;
+    void titleHandler(const char *title) { titles.push_back(title); }
+
+    struct TitleView
+    {
+        std::string title;
+        bool complete;
+    };
+    std::vector<TitleView> titleViews;
+    void titleViewHandler(const char *title, size_t length, bool complete)
+    {
+        TitleView view = { std::string(title, length), complete };
+        titleViews.push_back(view);
+    }
+
+    void pollingHandler(AdvancedRemote::PollingCommand, unsigned long) {}
+
+    struct LargeMessage
+    {
+        size_t chunks;
+        size_t bytes;
+        unsigned long sum;
+        size_t completed;
+        size_t failed;
+    } largeMessage;
+
+    void largeMessageHandler(size_t length, size_t offset, const byte *pChunk, size_t chunkLength,
+                             iPodSerial::LargeMessageStatus status)
+    {
+        (void) length;
+        (void) offset;
+        ++largeMessage.chunks;
+        largeMessage.bytes += chunkLength;
+        for (size_t i = 0; i < chunkLength; ++i)
+        {
+            largeMessage.sum += pChunk[i];
+        }
+        largeMessage.completed += (status == iPodSerial::LARGE_MESSAGE_COMPLETE);
+        largeMessage.failed += (status == iPodSerial::LARGE_MESSAGE_FAILED);
+    }
+
+    // feeds the bytes through a fresh AdvancedRemote, with or without a
+    // polling handler (without one, polling frames are skipped)
+    void run(AdvancedRemote &advancedRemote, const std::vector<byte> &bytes)
+    {
+        ByteStream stream;
+        stream.push(bytes);
+        advancedRemote.setSerial(stream);
+        titles.clear();
+        titleViews.clear();
+        memset(&largeMessage, 0, sizeof(largeMessage));
+        while (stream.available())
+        {
+            advancedRemote.loop();
+        }
+    }
+
+    int failures;
+
+    void report(const char *name, bool passed)
+    {
+        printf("%-48s %s\n", name, passed ? "ok" : "FAILED");
+        // in case a later check crashes
+        fflush(stdout);
+        failures += !passed;
+    }
+
+    void checkTruncatedUnwantedFrame()
+    {
+        std::vector<byte> bytes = pollingFrame();
+        bytes.resize(bytes.size() - 4);
+        const std::vector<byte> title = titleFrame("Bohemian Rhapsody");
+        bytes.insert(bytes.end(), title.begin(), title.end());
+
+        // the title should turn up whether the polling frame is wanted or not
+        bool passed = true;
+        for (int wanted = 0; wanted < 2; ++wanted)
+        {
+            AdvancedRemote advancedRemote;
+            advancedRemote.setTitleHandler(titleHandler);
+            if (wanted)
+            {
+                advancedRemote.setPollingHandler(pollingHandler);
+            }
+            run(advancedRemote, bytes);
+            passed = passed && (titles.size() == 1) && (titles[0] == "Bohemian Rhapsody");
+        }
+        report("truncated unwanted frame, then a wanted one", passed);
+    }
+
+    void checkBadSkippedFrame()
+    {
+        std::vector<byte> bytes = pollingFrame();
+        bytes.back() ^= 0x01;
+        const std::vector<byte> title = titleFrame("Queen");
+        bytes.insert(bytes.end(), title.begin(), title.end());
+
+        AdvancedRemote advancedRemote;
+        advancedRemote.setTitleHandler(titleHandler);
+        advancedRemote.setLargeMessageHandler(largeMessageHandler);
+        run(advancedRemote, bytes);
+
+        report("bad skipped frame with a large-message handler",
+               (largeMessage.chunks == 0) &&
+               (advancedRemote.getChecksumFailureCount() == 1) &&
+               (titles.size() == 1));
+    }
+
+    void checkFailedLargePacket()
+    {
+        const size_t LENGTH = 3 * IPOD_SERIAL_MAX_DATA_SIZE + 10;
+
+        std::vector<byte> bad = largeFrame(LENGTH);
+        bad[bad.size() / 2] ^= 0x10;
+        const std::vector<byte> title = titleFrame("A Night at the Opera");
+        bad.insert(bad.end(), title.begin(), title.end());
+
+        AdvancedRemote advancedRemote;
+        advancedRemote.setTitleHandler(titleHandler);
+        advancedRemote.setLargeMessageHandler(largeMessageHandler);
+        run(advancedRemote, bad);
+        const bool failedOnce = (largeMessage.failed == 1) && (largeMessage.completed == 0) &&
+                                (largeMessage.chunks > 1) && (titles.size() == 1);
+
+        // and a good one straight after still comes through whole
+        const std::vector<byte> good = largeFrame(LENGTH);
+        run(advancedRemote, good);
+        unsigned long sum = 0;
+        for (size_t i = 0; i < LENGTH; ++i)
+        {
+            sum += (byte) (i * 7);
+        }
+        const bool goodAfter = (largeMessage.failed == 0) && (largeMessage.completed == 1) &&
+                               (largeMessage.bytes == LENGTH) && (largeMessage.sum == sum);
+
+        report("large packet that goes bad part way through", failedOnce && goodAfter);
+    }
+
+    void checkOverLengthTitle()
+    {
+        std::string longTitle;
+        for (size_t i = 0; i < IPOD_SERIAL_MAX_DATA_SIZE + 50; ++i)
+        {
+            longTitle += (char) ('a' + i % 26);
+        }
+        const std::vector<byte> good = titleFrame(longTitle.c_str());
+        std::vector<byte> bad = good;
+        bad.back() ^= 0x01;
+        const std::vector<byte> after = titleFrame("Mercury");
+
+        // a view handler gets as much as fits, marked as cut short, and the
+        // large-message handler doesn't see it
+        std::vector<byte> bytes = good;
+        bytes.insert(bytes.end(), after.begin(), after.end());
+        AdvancedRemote advancedRemote;
+        advancedRemote.setTitleHandler(titleViewHandler);
+        advancedRemote.setLargeMessageHandler(largeMessageHandler);
+        run(advancedRemote, bytes);
+        const bool cutShort = (titleViews.size() == 2) &&
+                              (titleViews[0].title == longTitle.substr(0, IPOD_SERIAL_MAX_DATA_SIZE - 3)) &&
+                              !titleViews[0].complete &&
+                              (titleViews[1].title == "Mercury") && titleViews[1].complete &&
+                              (largeMessage.chunks == 0);
+
+        // unless its checksum is bad
+        bytes = bad;
+        bytes.insert(bytes.end(), after.begin(), after.end());
+        run(advancedRemote, bytes);
+        const bool badDropped = (titleViews.size() == 1) && (titleViews[0].title == "Mercury");
+
+        // and a handler that isn't given the length still doesn't get it
+        bytes = good;
+        bytes.insert(bytes.end(), after.begin(), after.end());
+        AdvancedRemote plainRemote;
+        plainRemote.setTitleHandler(titleHandler);
+        run(plainRemote, bytes);
+        const bool plainSkipped = (titles.size() == 1) && (titles[0] == "Mercury");
+
+        report("over-length title cut short for a view handler", cutShort && badDropped && plainSkipped);
+    }
+
+#if IPOD_SERIAL_STATS
+    void checkSkippedWhileWaiting()
+    {
+        // a request stays pending until it's answered, but frames that
+        // don't answer it, with nobody wanting them, can still be skipped
+        std::vector<byte> bytes = pollingFrame();
+        const std::vector<byte> title = titleFrame("Innuendo");
+        bytes.insert(bytes.end(), title.begin(), title.end());
+        const byte name[] = { 0x04, 0x00, AdvancedRemote::CMD_GET_ITEM_NAMES + 1, 0x00, 0x00, 0x00, 0x00, 'I', 't', 0x00 };
+        const std::vector<byte> answer = frame(std::vector<byte>(name, name + sizeof(name)));
+        bytes.insert(bytes.end(), answer.begin(), answer.end());
+
+        ByteStream stream;
+        AdvancedRemote advancedRemote;
+        advancedRemote.setSerial(stream);
+        advancedRemote.setRequestTimeout(1000, 0);
+        advancedRemote.getItemNames(AdvancedRemote::ITEM_SONG, 0, 1);
+        const bool waiting = (advancedRemote.getPendingRequestCount() == 1);
+        stream.push(bytes);
+        while (stream.available())
+        {
+            advancedRemote.loop();
+        }
+
+        // the answer still gets through to stop the wait, with no handler
+        report("unwanted frames skipped while a request waits",
+               waiting &&
+               (advancedRemote.getSkippedFrameCount() == 2) &&
+               (advancedRemote.getPendingRequestCount() == 0));
+    }
+#endif
+
+    // the good frames a parser gets out of the bytes, leaving out the ones
+    // with an odd command byte if it's skipping them, and how many
+    // checksum failures it counted
+    std::vector<std::string> parse(const std::vector<byte> &bytes, bool skipOdd, bool byteAtATime,
+                                   unsigned long &checksumFailures)
+    {
+        byte buffer[IPOD_SERIAL_MAX_DATA_SIZE + 1];
+        AAPFrameParser parser(buffer, sizeof(buffer));
+        parser.setHeaderEvents(skipOdd);
+
+        std::vector<std::string> frames;
+        size_t used = 0;
+        for (;;)
+        {
+            const size_t length = byteAtATime ? (used < bytes.size()) : bytes.size() - used;
+            used += parser.feed(bytes.empty() ? 0 : &bytes[used], length);
+
+            const AAPFrameParser::Event event = parser.getEvent();
+            const bool odd = (parser.frameLength() >= 3) && (parser.frameData()[2] & 1);
+            if ((event == AAPFrameParser::EVENT_FRAME_HEADER) && odd)
+            {
+                parser.skipFrame();
+            }
+            else if ((event == AAPFrameParser::EVENT_FRAME) && !(skipOdd && odd))
+            {
+                frames.push_back(std::string((const char *) parser.frameData(), parser.frameLength()));
+            }
+            else if ((event == AAPFrameParser::EVENT_NONE) && (used == bytes.size()))
+            {
+                break;
+            }
+        }
+#if IPOD_SERIAL_STATS
+        checksumFailures = parser.getChecksumFailureCount();
+#else
+        checksumFailures = 0;
+#endif
+        return frames;
+    }
+
+    // from a fixed seed, so every run is the same
+    unsigned long seed = 12345;
+
+    unsigned int nextRandom()
+    {
+        seed = seed * 1103515245UL + 12345UL;
+        return (seed >> 16) & 0x7FFF;
+    }
+
+    void checkRandomNoise()
+    {
+        bool passed = true;
+        for (int stream = 0; passed && (stream < 500); ++stream)
+        {
+            // frames full of stray 0xFF and 0x55 bytes, some cut short and
+            // some with noise after them
+            std::vector<byte> bytes;
+            for (int f = 0; f < 40; ++f)
+            {
+                std::vector<byte> data(3 + nextRandom() % 40);
+                for (size_t i = 0; i < data.size(); ++i)
+                {
+                    const unsigned int r = nextRandom();
+                    data[i] = (r % 6 == 0) ? 0xFF : (r % 5 == 0) ? 0x55 : (byte) (r >> 8);
+                }
+                std::vector<byte> bytesOfFrame = frame(data);
+                if (nextRandom() % 4 == 0)
+                {
+                    bytesOfFrame.resize(nextRandom() % bytesOfFrame.size());
+                }
+                bytes.insert(bytes.end(), bytesOfFrame.begin(), bytesOfFrame.end());
+                if (nextRandom() % 6 == 0)
+                {
+                    bytes.push_back((byte) nextRandom());
+                }
+            }
+
+            // a byte at a time with nothing skipped is how iPodSerial did it
+            // before frames could be skipped, so the others should match it
+            unsigned long expectedFailures;
+            const std::vector<std::string> expected = parse(bytes, false, true, expectedFailures);
+            for (int way = 1; way < 4; ++way)
+            {
+                const bool skipOdd = way & 1;
+                unsigned long checksumFailures;
+                const std::vector<std::string> frames = parse(bytes, skipOdd, !(way & 2), checksumFailures);
+                std::vector<std::string> wanted;
+                for (size_t i = 0; i < expected.size(); ++i)
+                {
+                    if (!(skipOdd && (expected[i].size() >= 3) && (expected[i][2] & 1)))
+                    {
+                        wanted.push_back(expected[i]);
+                    }
+                }
+                passed = passed && (frames == wanted) && (checksumFailures == expectedFailures);
+            }
+        }
+        report("random noise, skipped and bulk-fed", passed);
+    }
+}
+
+int main()
+{
+    checkTruncatedUnwantedFrame();
+    checkBadSkippedFrame();
+    checkFailedLargePacket();
+    checkOverLengthTitle();
+#if IPOD_SERIAL_STATS
+    checkSkippedWhileWaiting();
+#endif
+    checkRandomNoise();
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,246 @@
+/*******************************************************************************
+ * Copyright (c) 2009 David Findlay
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *    - Redistributions of source code must retain the above copyright notice,
+ *      this list of conditions and the following disclaimer.
+ *    - Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ ******************************************************************************/
+
+// Measures, in virtual time over a modelled serial link, how long some
+// everyday AdvancedRemote operations take against a simulated iPod: what
+// a real sketch would see at 19200 baud, rather than how fast a PC can
+// run the library.
+//
+//   link_latency [baud] [loop us] [iPod delay us] [playlists] [rx buffer] [trace file]
+//
+// "loop us" is how long the rest of the sketch takes between calls to
+// AdvancedRemote::loop(); "iPod delay us" is how long the iPod takes to
+// start answering each command. Given a trace file, the last
+// TRACE_RECORDS bytes of traffic are written to it as a wire trace, for
+// trace_replay.
+
+#include "AdvancedRemote.h"
+#include "HostClock.h"
+#include "SerialLink.h"
+#include "SimulatediPod.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+namespace
+{
+    const unsigned long GIVE_UP_MICROS = 600000000UL;
+    const size_t TRACE_RECORDS = 16384;
+
+    class FilePrint : public Print
+    {
+    public:
+        explicit FilePrint(FILE *pFile) : pFile(pFile) {}
+
+        virtual size_t write(uint8_t b)
+        {
+            return (fputc(b, pFile) == EOF) ? 0 : 1;
+        }
+
+        virtual size_t write(const uint8_t *buffer, size_t size)
+        {
+            return fwrite(buffer, 1, size, pFile);
+        }
+
+    private:
+        FILE *pFile;
+    };
+
+    AdvancedRemote advancedRemote;
+    SerialLink *pLink;
+    unsigned long loopMicros;
+
+    unsigned long itemCount;
+    unsigned long itemNames;
+    unsigned long strings;
+    unsigned long feedbacks;
+
+    void itemCountHandler(unsigned long count)
+    {
+        itemCount = count;
+    }
+
+    void itemNameHandler(unsigned long offset, const char *itemName)
+    {
+        (void) offset;
+        (void) itemName;
+        ++itemNames;
+    }
+
+    void stringHandler(const char *string)
+    {
+        (void) string;
+        ++strings;
+    }
+
+    void feedbackHandler(AdvancedRemote::Feedback feedback, byte cmd)
+    {
+        (void) feedback;
+        (void) cmd;
+        ++feedbacks;
+    }
+
+    // runs the sketch until the counter reaches the target
+    bool runUntil(const unsigned long &counter, unsigned long target)
+    {
+        const unsigned long start = micros();
+        while (counter < target)
+        {
+            if (micros() - start > GIVE_UP_MICROS)
+            {
+                return false;
+            }
+            advancedRemote.loop();
+            pLink->advance(loopMicros);
+        }
+        return true;
+    }
+
+    // reads argv[index] as a number, or gives the default if it wasn't
+    // given; false if it isn't a number, or is 0 where that's not allowed
+    bool numberArgument(int argc, char *argv[], int index, unsigned long defaultValue,
+                        bool zeroAllowed, unsigned long &value)
+    {
+        if (argc <= index)
+        {
+            value = defaultValue;
+            return true;
+        }
+
+        char *pEnd;
+        value = strtoul(argv[index], &pEnd, 0);
+        return (pEnd != argv[index]) && (*pEnd == '\0') && (zeroAllowed || value);
+    }
+
+    void report(const char *name, unsigned long startMicros, bool finished)
+    {
+        const unsigned long elapsed = micros() - startMicros;
+        printf("%-36s %10.1f ms%s\n", name, elapsed / 1000.0, finished ? "" : " (gave up)");
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    // the baud rate sets the time per byte and the loop time is the only
+    // thing moving the clock along, so neither can be 0
+    unsigned long baudRate;
+    unsigned long iPodDelayMicros;
+    unsigned long playlists;
+    unsigned long receiveSize;
+    if (!numberArgument(argc, argv, 1, iPodSerial::IPOD_SERIAL_RATE, false, baudRate) ||
+        !numberArgument(argc, argv, 2, 100, false, loopMicros) ||
+        !numberArgument(argc, argv, 3, 1000, true, iPodDelayMicros) ||
+        !numberArgument(argc, argv, 4, 2000, true, playlists) ||
+        !numberArgument(argc, argv, 5, 64, true, receiveSize) ||
+        (argc > 7))
+    {
+        fprintf(stderr, "usage: %s [baud] [loop us] [iPod delay us] [playlists] [rx buffer] [trace file]\n", argv[0]);
+        return 2;
+    }
+    const char *tracePath = (argc > 6) ? argv[6] : 0;
+
+    SimulatediPod iPod;
+    SimulatediPod::Library library = iPod.getLibrary();
+    library.songCount = 50000;
+    library.playlistCount = playlists;
+    iPod.setLibrary(library);
+    iPod.setResponseDelayMicros(iPodDelayMicros);
+
+    SerialLink link(iPod, baudRate);
+    link.setBufferSizes(64, receiveSize);
+    pLink = &link;
+
+    advancedRemote.setSerial(link);
+    advancedRemote.setItemCountHandler(itemCountHandler);
+    advancedRemote.setItemNameHandler(itemNameHandler);
+    advancedRemote.setTitleHandler(stringHandler);
+    advancedRemote.setArtistHandler(stringHandler);
+    advancedRemote.setAlbumHandler(stringHandler);
+    advancedRemote.setFeedbackHandler(feedbackHandler);
+
+    static byte traceBuffer[TRACE_RECORDS * AAPWireTrace::RECORD_SIZE];
+    if (tracePath)
+    {
+        advancedRemote.setWireTrace(traceBuffer, sizeof(traceBuffer));
+    }
+
+    printf("%lu baud, %.1f us per byte, %lu us per loop, iPod delay %lu us, %u byte receive buffer\n",
+           baudRate, link.getByteNanos() / 1000.0, loopMicros, iPodDelayMicros, (unsigned) receiveSize);
+
+    unsigned long start = micros();
+    advancedRemote.enable();
+    advancedRemote.switchToMainLibraryPlaylist();
+    bool finished = runUntil(feedbacks, 1);
+    report("enable and switch to main library", start, finished);
+
+    start = micros();
+    strings = 0;
+    advancedRemote.getTitle(0);
+    advancedRemote.getArtist(0);
+    advancedRemote.getAlbum(0);
+    finished = runUntil(strings, 3);
+    report("fetch title, artist and album", start, finished);
+
+    start = micros();
+    feedbacks = 0;
+    advancedRemote.controlPlayback(AdvancedRemote::PLAYBACK_CONTROL_PLAY_PAUSE);
+    finished = runUntil(feedbacks, 1);
+    report("play/pause acknowledged", start, finished);
+
+    start = micros();
+    itemCount = 0;
+    itemNames = 0;
+    advancedRemote.getItemCount(AdvancedRemote::ITEM_PLAYLIST);
+    finished = runUntil(itemCount, 1);
+    if (finished)
+    {
+        advancedRemote.getItemNames(AdvancedRemote::ITEM_PLAYLIST, 0, itemCount);
+        finished = runUntil(itemNames, itemCount);
+    }
+    report("dump all playlist names", start, finished);
+
+    printf("bytes to iPod=%lu from iPod=%lu receive overruns=%lu peak receive fill=%u transmit blocked=%.1f ms\n",
+           link.getBytesToDevice(), link.getBytesFromDevice(), link.getReceiveOverruns(),
+           (unsigned) link.getPeakReceiveFill(), link.getTransmitBlockedNanos() / 1e6);
+
+#if IPOD_SERIAL_LATENCY_HISTOGRAMS
+    advancedRemote.printLatencyHistograms(Serial);
+#endif
+
+    if (tracePath)
+    {
+        FILE *pFile = fopen(tracePath, "wb");
+        if (!pFile)
+        {
+            perror(tracePath);
+            return 1;
+        }
+        FilePrint out(pFile);
+        advancedRemote.dumpWireTrace(out);
+        fclose(pFile);
+    }
+
+    return 0;
+}
@@ -0,0 +1,242 @@
+/*******************************************************************************
+ * Copyright (c) 2009 David Findlay
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *    - Redistributions of source code must retain the above copyright notice,
+ *      this list of conditions and the following disclaimer.
+ *    - Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ ******************************************************************************/
+
+// Load test: dumps every song and playlist name from a simulated iPod
+// through AdvancedRemote, the way a sketch browsing a big library would,
+// and checks that each name arrives once and intact.
+//
+//   load_test [songs] [playlists] [byte error rate] [response delay us] [seed]
+//
+// The byte error rate is a probability, from 0 to 1. Above 0 some names
+// will be lost or need retrying; the point then is to see how many, and
+// that nothing worse happens.
+
+#include "AdvancedRemote.h"
+#include "SimulatediPod.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <vector>
+
+#if !IPOD_SERIAL_REQUEST_TIMEOUTS
+#error "load_test needs IPOD_SERIAL_REQUEST_TIMEOUTS defined as 1"
+#endif
+
+namespace
+{
+    const unsigned long BATCH_SIZE = 100;
+    const unsigned long REQUEST_TIMEOUT_MILLIS = 100;
+    const byte REQUEST_RETRIES = 3;
+    const unsigned long GIVE_UP_MILLIS = 120000;
+
+    AdvancedRemote advancedRemote;
+
+    const char *expectedPrefix;
+    std::vector<unsigned char> received;
+    unsigned long itemCount;
+    bool haveItemCount;
+    unsigned long goodNames;
+    unsigned long badNames;
+    unsigned long duplicateNames;
+    unsigned long timeouts;
+
+    void itemCountHandler(unsigned long count)
+    {
+        itemCount = count;
+        haveItemCount = true;
+    }
+
+    void itemNameHandler(unsigned long offset, const char *itemName)
+    {
+        char expected[64];
+        if ((offset == 0) && (expectedPrefix[0] == 'P'))
+        {
+            snprintf(expected, sizeof(expected), "Simulated iPod");
+        }
+        else
+        {
+            snprintf(expected, sizeof(expected), "%s %lu", expectedPrefix, offset);
+        }
+
+        if ((offset >= received.size()) || strcmp(itemName, expected))
+        {
+            ++badNames;
+        }
+        else if (received[offset])
+        {
+            ++duplicateNames;
+        }
+        else
+        {
+            received[offset] = 1;
+            ++goodNames;
+        }
+    }
+
+    void timeoutHandler(byte cmd)
+    {
+        (void) cmd;
+        ++timeouts;
+    }
+
+    void waitForIdle()
+    {
+        const unsigned long start = millis();
+        while (advancedRemote.getPendingRequestCount() && (millis() - start < GIVE_UP_MILLIS))
+        {
+            advancedRemote.loop();
+        }
+    }
+
+    // returns the number of names that never arrived
+    unsigned long dump(AdvancedRemote::ItemType itemType, const char *prefix)
+    {
+        expectedPrefix = prefix;
+        haveItemCount = false;
+
+        // the count can get lost too, so keep asking
+        for (byte attempt = 0; !haveItemCount && (attempt <= REQUEST_RETRIES); ++attempt)
+        {
+            advancedRemote.getItemCount(itemType);
+            waitForIdle();
+        }
+        if (!haveItemCount)
+        {
+            printf("%s: never got the item count\n", prefix);
+            return 0;
+        }
+
+        received.assign(itemCount, 0);
+        goodNames = 0;
+        badNames = 0;
+        duplicateNames = 0;
+
+        const unsigned long start = micros();
+        for (unsigned long offset = 0; offset < itemCount; offset += BATCH_SIZE)
+        {
+            const unsigned long count = (itemCount - offset < BATCH_SIZE) ? itemCount - offset : BATCH_SIZE;
+            while (!advancedRemote.getItemNames(itemType, offset, count))
+            {
+                advancedRemote.loop();
+            }
+            waitForIdle();
+        }
+        const unsigned long elapsed = micros() - start;
+
+        const unsigned long missing = itemCount - goodNames;
+        printf("%s: %lu items, %lu good, %lu bad, %lu duplicates, %lu missing, %.1f names/s\n",
+               prefix, itemCount, goodNames, badNames, duplicateNames, missing,
+               elapsed ? goodNames * 1e6 / elapsed : 0.0);
+        return missing;
+    }
+
+    // reads argv[index] as a number, or gives the default if it wasn't
+    // given; false if it isn't a number, or is 0 where that's not allowed
+    bool numberArgument(int argc, char *argv[], int index, unsigned long defaultValue,
+                        bool zeroAllowed, unsigned long &value)
+    {
+        if (argc <= index)
+        {
+            value = defaultValue;
+            return true;
+        }
+
+        char *pEnd;
+        value = strtoul(argv[index], &pEnd, 0);
+        return (pEnd != argv[index]) && (*pEnd == '\0') && (zeroAllowed || value);
+    }
+
+    // the same for a probability, which has to be from 0 to 1
+    bool rateArgument(int argc, char *argv[], int index, double &value)
+    {
+        if (argc <= index)
+        {
+            value = 0;
+            return true;
+        }
+
+        char *pEnd;
+        value = strtod(argv[index], &pEnd);
+        return (pEnd != argv[index]) && (*pEnd == '\0') && (value >= 0) && (value <= 1);
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    // a library needs a song, and the main library playlist is always there
+    SimulatediPod::Library library;
+    double errorRate;
+    unsigned long delayMicros;
+    unsigned long seed;
+    if (!numberArgument(argc, argv, 1, 50000, false, library.songCount) ||
+        !numberArgument(argc, argv, 2, 2000, false, library.playlistCount) ||
+        !rateArgument(argc, argv, 3, errorRate) ||
+        !numberArgument(argc, argv, 4, 0, true, delayMicros) ||
+        !numberArgument(argc, argv, 5, 1, true, seed) ||
+        (argc > 6))
+    {
+        fprintf(stderr, "usage: %s [songs] [playlists] [byte error rate] [response delay us] [seed]\n", argv[0]);
+        return 2;
+    }
+    library.artistCount = 1000;
+    library.albumCount = 4000;
+    library.genreCount = 30;
+    library.composerCount = 500;
+    library.trackLengthMillis = 200000;
+
+    SimulatediPod iPod;
+    iPod.setLibrary(library);
+    iPod.setByteErrorRate(errorRate, seed);
+    iPod.setResponseDelayMicros(delayMicros);
+
+    advancedRemote.setSerial(iPod);
+    advancedRemote.setItemCountHandler(itemCountHandler);
+    advancedRemote.setItemNameHandler(itemNameHandler);
+    advancedRemote.setTimeoutHandler(timeoutHandler);
+    advancedRemote.setRequestTimeout(REQUEST_TIMEOUT_MILLIS, REQUEST_RETRIES);
+
+    advancedRemote.enable();
+    advancedRemote.switchToMainLibraryPlaylist();
+
+    unsigned long missing = dump(AdvancedRemote::ITEM_SONG, "Song");
+    missing += dump(AdvancedRemote::ITEM_PLAYLIST, "Playlist");
+
+    printf("commands=%lu responses=%lu corrupted bytes=%lu resyncs=%lu timeouts=%lu\n",
+           iPod.getCommandCount(), iPod.getResponseCount(), iPod.getCorruptedByteCount(),
+           advancedRemote.getResyncCount(), timeouts);
+#if IPOD_SERIAL_STATS
+    printf("frames=%lu bytes=%lu checksum failures=%lu discarded=%lu over-length=%lu unhandled=%lu skipped=%lu peak available=%d\n",
+           advancedRemote.getFramesReceived(), advancedRemote.getBytesReceived(),
+           advancedRemote.getChecksumFailureCount(), advancedRemote.getBytesDiscarded(),
+           advancedRemote.getOverLengthFrameCount(), advancedRemote.getUnhandledFrameCount(),
+           advancedRemote.getSkippedFrameCount(), advancedRemote.getPeakAvailable());
+#endif
+#if IPOD_SERIAL_PROFILE
+    advancedRemote.printProfile(Serial);
+#endif
+
+    // on a clean link everything has to get through
+    return ((errorRate == 0) && missing) ? 1 : 0;
+}
@@ -0,0 +1,393 @@
+/*******************************************************************************
+ * Copyright (c) 2009 David Findlay
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *    - Redistributions of source code must retain the above copyright notice,
+ *      this list of conditions and the following disclaimer.
+ *    - Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ ******************************************************************************/
+
+// Plays a wire trace (see AAPWireTrace.h) captured with
+// iPodSerial::setWireTrace() back through the library, so that something
+// caught in the field can be reproduced, debugged and profiled on a PC.
+//
+//   trace_replay [--simple] [--quiet] [--repeat N] trace-file
+//
+// The bytes the iPod sent are fed to an AdvancedRemote (or a SimpleRemote,
+// with --simple) at the times they were recorded, in virtual time, with
+// loop() called after each one. Every handler call is printed with its
+// time, so two replays can be compared with diff; --quiet leaves that out.
+// With --repeat the trace is played N times and the time the library took
+// to get through it on this PC is reported too.
+
+#include "AdvancedRemote.h"
+#include "HostClock.h"
+#include "SimpleRemote.h"
+
+#include <chrono>
+#include <deque>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+
+namespace
+{
+    struct Record
+    {
+        byte type;
+        byte data;
+        unsigned int delta;
+    };
+
+    // Stands in for the serial port: hands the library the bytes the iPod
+    // sent, and swallows anything the library sends.
+    class ReplayStream : public Stream
+    {
+    public:
+        ReplayStream() : sent(0) {}
+
+        void push(byte b) { pending.push_back(b); }
+
+        virtual size_t write(uint8_t b)
+        {
+            (void) b;
+            ++sent;
+            return 1;
+        }
+
+        virtual int available() { return pending.size(); }
+
+        virtual int read()
+        {
+            if (pending.empty())
+            {
+                return -1;
+            }
+            const byte b = pending.front();
+            pending.pop_front();
+            return b;
+        }
+
+        virtual int peek() { return pending.empty() ? -1 : pending.front(); }
+
+        unsigned long sent;
+
+    private:
+        std::deque<byte> pending;
+    };
+
+    bool quiet;
+
+    void stamp()
+    {
+        printf("%12.3f ms  ", getVirtualNanos() / 1e6);
+    }
+
+    void feedbackHandler(AdvancedRemote::Feedback feedback, byte cmd)
+    {
+        if (!quiet)
+        {
+            stamp();
+            printf("feedback 0x%02X for command 0x%02X\n", feedback, cmd);
+        }
+    }
+
+    void iPodNameHandler(const char *name)
+    {
+        if (!quiet)
+        {
+            stamp();
+            printf("iPod name \"%s\"\n", name);
+        }
+    }
+
+    void itemCountHandler(unsigned long count)
+    {
+        if (!quiet)
+        {
+            stamp();
+            printf("item count %lu\n", count);
+        }
+    }
+
+    void itemNameHandler(unsigned long offset, const char *itemName)
+    {
+        if (!quiet)
+        {
+            stamp();
+            printf("item %lu \"%s\"\n", offset, itemName);
+        }
+    }
+
+    void timeAndStatusHandler(unsigned long trackLength, unsigned long elapsed, AdvancedRemote::PlaybackStatus status)
+    {
+        if (!quiet)
+        {
+            stamp();
+            printf("time %lu of %lu ms, status %d\n", elapsed, trackLength, status);
+        }
+    }
+
+    void playlistPositionHandler(unsigned long position)
+    {
+        if (!quiet)
+        {
+            stamp();
+            printf("playlist position %lu\n", position);
+        }
+    }
+
+    void titleHandler(const char *title)
+    {
+        if (!quiet)
+        {
+            stamp();
+            printf("title \"%s\"\n", title);
+        }
+    }
+
+    void artistHandler(const char *artist)
+    {
+        if (!quiet)
+        {
+            stamp();
+            printf("artist \"%s\"\n", artist);
+        }
+    }
+
+    void albumHandler(const char *album)
+    {
+        if (!quiet)
+        {
+            stamp();
+            printf("album \"%s\"\n", album);
+        }
+    }
+
+    void pollingHandler(AdvancedRemote::PollingCommand command, unsigned long number)
+    {
+        if (!quiet)
+        {
+            stamp();
+            printf("polling %d %lu\n", command, number);
+        }
+    }
+
+    void shuffleModeHandler(AdvancedRemote::ShuffleMode mode)
+    {
+        if (!quiet)
+        {
+            stamp();
+            printf("shuffle mode %d\n", mode);
+        }
+    }
+
+    void repeatModeHandler(AdvancedRemote::RepeatMode mode)
+    {
+        if (!quiet)
+        {
+            stamp();
+            printf("repeat mode %d\n", mode);
+        }
+    }
+
+    void songCountHandler(unsigned long count)
+    {
+        if (!quiet)
+        {
+            stamp();
+            printf("song count %lu\n", count);
+        }
+    }
+
+    void largeMessageHandler(size_t length, size_t offset, const byte *pChunk, size_t chunkLength,
+                             iPodSerial::LargeMessageStatus status)
+    {
+        (void) pChunk;
+        if (!quiet)
+        {
+            stamp();
+            printf("large message of %u bytes, %u at offset %u, status %d\n",
+                   (unsigned) length, (unsigned) chunkLength, (unsigned) offset, status);
+        }
+    }
+
+    bool load(const char *path, std::vector<Record> &records)
+    {
+        FILE *pFile = fopen(path, "rb");
+        if (!pFile)
+        {
+            perror(path);
+            return false;
+        }
+
+        byte header[9];
+        if ((fread(header, 1, sizeof(header), pFile) != sizeof(header)) ||
+            memcmp(header, "AAPT", 4) ||
+            (header[4] != AAPWireTrace::FORMAT_VERSION))
+        {
+            fprintf(stderr, "%s: not a version %d wire trace\n", path, AAPWireTrace::FORMAT_VERSION);
+            fclose(pFile);
+            return false;
+        }
+
+        const unsigned long count = ((unsigned long) header[5] << 24) | ((unsigned long) header[6] << 16) |
+                                    ((unsigned long) header[7] << 8) | header[8];
+        for (unsigned long i = 0; i < count; ++i)
+        {
+            byte bytes[AAPWireTrace::RECORD_SIZE];
+            if (fread(bytes, 1, sizeof(bytes), pFile) != sizeof(bytes))
+            {
+                fprintf(stderr, "%s: truncated after %lu of %lu records\n", path, i, count);
+                break;
+            }
+            const Record record = {bytes[0], bytes[1], (unsigned int) ((bytes[2] << 8) | bytes[3])};
+            records.push_back(record);
+        }
+
+        fclose(pFile);
+        return true;
+    }
+
+    // a template, since each remote's loop() is its own
+    template <class Remote>
+    void replay(Remote &remote, ReplayStream &stream, const std::vector<Record> &records)
+    {
+        for (size_t i = 0; i < records.size(); ++i)
+        {
+            const Record &record = records[i];
+
+            // the first delta is measured from something that isn't in the trace
+            if (i > 0)
+            {
+                const unsigned long long unit = (record.type == AAPWireTrace::RECORD_GAP) ? 1000000ULL : 1000ULL;
+                advanceVirtualNanos(record.delta * unit);
+            }
+
+            if (record.type == AAPWireTrace::RECORD_RECEIVED)
+            {
+                stream.push(record.data);
+            }
+            remote.loop();
+        }
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    bool simple = false;
+    unsigned long repeat = 1;
+    const char *path = 0;
+
+    for (int i = 1; i < argc; ++i)
+    {
+        if (!strcmp(argv[i], "--simple"))
+        {
+            simple = true;
+        }
+        else if (!strcmp(argv[i], "--quiet"))
+        {
+            quiet = true;
+        }
+        else if (!strcmp(argv[i], "--repeat") && (i + 1 < argc))
+        {
+            repeat = strtoul(argv[++i], 0, 0);
+        }
+        else
+        {
+            path = argv[i];
+        }
+    }
+
+    std::vector<Record> records;
+    if (!path || (repeat == 0))
+    {
+        fprintf(stderr, "usage: %s [--simple] [--quiet] [--repeat N] trace-file\n", argv[0]);
+        return 2;
+    }
+    if (!load(path, records))
+    {
+        return 1;
+    }
+
+    unsigned long received = 0;
+    unsigned long sent = 0;
+    for (size_t i = 0; i < records.size(); ++i)
+    {
+        received += (records[i].type == AAPWireTrace::RECORD_RECEIVED);
+        sent += (records[i].type == AAPWireTrace::RECORD_SENT);
+    }
+
+    ReplayStream stream;
+    AdvancedRemote advancedRemote;
+    SimpleRemote simpleRemote;
+    iPodSerial &remote = simple ? (iPodSerial &) simpleRemote : (iPodSerial &) advancedRemote;
+
+    remote.setSerial(stream);
+    remote.setLargeMessageHandler(largeMessageHandler);
+    advancedRemote.setFeedbackHandler(feedbackHandler);
+    advancedRemote.setiPodNameHandler(iPodNameHandler);
+    advancedRemote.setItemCountHandler(itemCountHandler);
+    advancedRemote.setItemNameHandler(itemNameHandler);
+    advancedRemote.setTimeAndStatusHandler(timeAndStatusHandler);
+    advancedRemote.setPlaylistPositionHandler(playlistPositionHandler);
+    advancedRemote.setTitleHandler(titleHandler);
+    advancedRemote.setArtistHandler(artistHandler);
+    advancedRemote.setAlbumHandler(albumHandler);
+    advancedRemote.setPollingHandler(pollingHandler);
+    advancedRemote.setShuffleModeHandler(shuffleModeHandler);
+    advancedRemote.setRepeatModeHandler(repeatModeHandler);
+    advancedRemote.setCurrentPlaylistSongCountHandler(songCountHandler);
+
+    setVirtualTime(true);
+
+    const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    for (unsigned long pass = 0; pass < repeat; ++pass)
+    {
+        if (simple)
+        {
+            replay(simpleRemote, stream, records);
+        }
+        else
+        {
+            replay(advancedRemote, stream, records);
+        }
+        quiet = true; // once is enough
+    }
+    const double elapsedNanos = std::chrono::duration<double, std::nano>(
+        std::chrono::steady_clock::now() - start).count();
+
+    printf("%u records: %lu bytes from the iPod, %lu to it, over %.3f ms\n",
+           (unsigned) records.size(), received, sent, getVirtualNanos() / 1e6 / repeat);
+#if IPOD_SERIAL_STATS
+    printf("frames=%lu checksum failures=%lu discarded=%lu over-length=%lu unhandled=%lu skipped=%lu resyncs=%lu\n",
+           remote.getFramesReceived() / repeat, remote.getChecksumFailureCount() / repeat,
+           remote.getBytesDiscarded() / repeat, remote.getOverLengthFrameCount() / repeat,
+           remote.getUnhandledFrameCount() / repeat, remote.getSkippedFrameCount() / repeat,
+           remote.getResyncCount() / repeat);
+#endif
+    if (repeat > 1)
+    {
+        printf("%lu passes in %.1f ms, %.1f ns per byte received\n",
+               repeat, elapsedNanos / 1e6, received ? elapsedNanos / repeat / received : 0.0);
+    }
+
+    return 0;
+}
@@ -23,367 +23,911 @@
  * POSSIBILITY OF SUCH DAMAGE.
  ******************************************************************************/
 #include "iPodSerial.h"
-#include <ctype.h>
 
-static const char *STATE_NAME[] =
+#if IPOD_SERIAL_LOG_LEVEL >= IPOD_SERIAL_LOG_TRACE
+// returns a PSTR(), to keep the names out of RAM
+static const char *stateName(AAPFrameParser::ReceiveState state)
 {
-    "Waiting for Header 1",
-    "Waiting for Header 2",
-    "Waiting for length",
-    "Waiting for data",
-    "Waiting for checksum"
-};
+    switch (state)
+    {
+    case AAPFrameParser::WAITING_FOR_HEADER1:
+        return PSTR("Waiting for Header 1:");
+    case AAPFrameParser::WAITING_FOR_HEADER2:
+        return PSTR("Waiting for Header 2:");
+    case AAPFrameParser::WAITING_FOR_LENGTH:
+        return PSTR("Waiting for length:");
+    case AAPFrameParser::WAITING_FOR_LENGTH_HIGH:
+        return PSTR("Waiting for length high byte:");
+    case AAPFrameParser::WAITING_FOR_LENGTH_LOW:
+        return PSTR("Waiting for length low byte:");
+    case AAPFrameParser::WAITING_FOR_DATA:
+        return PSTR("Waiting for data:");
+    case AAPFrameParser::WAITING_FOR_CHECKSUM:
+        return PSTR("Waiting for checksum:");
+    }
+    return PSTR("?");
+}
+#endif
 
 iPodSerial::iPodSerial()
-    : receiveState(WAITING_FOR_HEADER1),
-      dataSize(0),
-      pData(0),
-      checksum(0),
-      pSerial(&Serial) // default to regular serial port as that's all most Arduinos have
+    : dataSize(0),
 #if defined(IPOD_SERIAL_DEBUG)
-    ,
       pDebugPrint(0),   // default to no debug, since most Arduinos don't have a spare serial to use for debug
-      pLogPrint(0)      // default to no log, since most Arduinos don't have a spare serial to use for debug
+      pLogPrint(0),     // default to no log, since most Arduinos don't have a spare serial to use for debug
+      debugLog(debugLogBuffer, sizeof(debugLogBuffer)),
+#endif
+      parser(dataBuffer, sizeof(dataBuffer)),
+      pSerial(&Serial), // default to regular serial port as that's all most Arduinos have
+      writeRoomSeen(false),
+      receiveBudgetBytes(0),
+      receiveBudgetMillis(0),
+      lastLoopFrameCount(0),
+      resyncStartMillis(0),
+      lastResyncMillis(0),
+      pLargeMessageHandler(0),
+      pActiveQueue(0),
+      activeFrameRemaining(0),
+      activeFrameMicros(0),
+      lastInteractiveLatencyMicros(0),
+      maxInteractiveLatencyMicros(0)
+#if IPOD_SERIAL_STATS
+    ,
+      framesReceived(0),
+      bytesReceived(0),
+      unhandledFrames(0),
+      peakAvailable(0)
 #endif
 {
+    parser.setHeaderEvents(true);
+#if IPOD_SERIAL_PROFILE
+    resetProfile();
+#endif
 }
 
 void iPodSerial::setSerial(Stream &newiPodSerial)
 {
     pSerial = &newiPodSerial;
+    writeRoomSeen = false;
+}
+
+void iPodSerial::setLargeMessageHandler(LargeMessageHandler_t newHandler)
+{
+    pLargeMessageHandler = newHandler;
+    parser.setStreaming(newHandler != 0);
 }
 
 #if defined(IPOD_SERIAL_DEBUG)
 void iPodSerial::setDebugPrint(Print &newPrint)
 {
     pDebugPrint = &newPrint;
-    pDebugPrint->println("Debug Print now set");
+    debug(PSTR("Debug Print now set"));
 }
 
 void iPodSerial::setLogPrint(Print &newPrint)
 {
     pLogPrint = &newPrint;
+    debug(PSTR("Log Print now set"));
+}
 
-    if (pDebugPrint)
+void iPodSerial::flushDebugLog()
+{
+    while (!debugLog.isEmpty())
     {
-        pDebugPrint->println("Log Print now set");
+        debugLog.printOne(pDebugPrint, pLogPrint);
     }
 }
 #endif
 
-bool iPodSerial::validChecksum(byte actual)
+#if defined(IPOD_SERIAL_DEBUG)
+void iPodSerial::dumpReceive()
+{
+    debugBytes(PSTR("data:"), dataBuffer, dataSize);
+}
+#endif
+
+bool iPodSerial::sendCommandWithLength(
+    size_t length,
+    const byte *pData)
 {
-    int expected = dataSize;
-    for (int i = 0; i < dataSize; ++i)
+    // the simple remote's buttons and mode switches are all things
+    // the user is waiting on
+    return sendFrame(length, pData, PRIORITY_INTERACTIVE);
+}
+
+bool iPodSerial::sendFrame(
+    size_t length,
+    const byte *pData,
+    CommandPriority priority)
+{
+#if IPOD_SERIAL_LOG_LEVEL >= IPOD_SERIAL_LOG_INFO
+    debugNumber(PSTR("Sending command of length: "), length);
+#endif
+
+    const unsigned long startMicros = micros();
+
+    // header, up to 3 length bytes, the data and the checksum
+    byte frame[2 + 3 + MAX_ASSEMBLED_DATA_SIZE + 1];
+    size_t frameLength = writeHeaderAndLength(frame, length);
+    const byte checksum = calculateChecksum(&frame[2], frameLength - 2, length, pData);
+    const size_t total = frameLength + length + 1;
+
+    TransmitQueue *pQueue;
+    if (!chooseQueue(total, priority, startMicros, pQueue))
     {
-        expected += dataBuffer[i];
+        return false;
     }
 
-    expected = (0x100 - expected) & 0xFF;
+    if (length <= MAX_ASSEMBLED_DATA_SIZE)
+    {
+        // the normal case: put the whole thing together and send it in one go
+        memcpy(&frame[frameLength], pData, length);
+        frameLength += length;
+        frame[frameLength++] = checksum;
+        sendBytes(frameLength, frame, pQueue);
+    }
+    else
+    {
+        // too big to assemble, so send it from where it is
+        sendBytes(frameLength, frame, pQueue);
+        sendBytes(length, pData, pQueue);
+        sendBytes(1, &checksum, pQueue);
+    }
 
-    if (expected == actual)
+    if (!pQueue && (priority == PRIORITY_INTERACTIVE))
     {
+        recordInteractiveLatency(micros() - startMicros);
+    }
+
+    return true;
+}
+
+bool iPodSerial::sendFrameFromFlash(
+    size_t frameLength,
+    const byte *pFrame,
+    CommandPriority priority)
+{
+    const unsigned long startMicros = micros();
+
+    TransmitQueue *pQueue;
+    if (!chooseQueue(frameLength, priority, startMicros, pQueue))
+    {
+        return false;
+    }
+
+    // the serial port and the queues want it in RAM
+    byte frame[2 + 3 + MAX_ASSEMBLED_DATA_SIZE + 1];
+    memcpy_P(frame, pFrame, frameLength);
+    sendBytes(frameLength, frame, pQueue);
+
+    if (!pQueue && (priority == PRIORITY_INTERACTIVE))
+    {
+        recordInteractiveLatency(micros() - startMicros);
+    }
+
+    return true;
+}
+
+bool iPodSerial::chooseQueue(
+    size_t frameLength,
+    CommandPriority priority,
+    unsigned long startMicros,
+    TransmitQueue *&pQueue)
+{
+    // If nothing's waiting and the serial port can take it straight away
+    // there's no need to queue it; otherwise it goes at the back of the
+    // queue for its priority. With no queues at all we just write it and
+    // wait, as we always used to.
+    pQueue = 0;
+    const int room = writeRoom();
+    if (room < 0)
+    {
+        // The port can't say whether it has room, so every write to it
+        // blocks; send anything queued before this port was set first.
+        drainTransmitQueue();
         return true;
     }
-    else
+
+    const bool idle = (activeFrameRemaining == 0) &&
+                      (transmitQueue.depth() == 0) &&
+                      (priorityTransmitQueue.depth() == 0);
+    if (!idle || ((size_t) room < frameLength))
     {
-#if defined(IPOD_SERIAL_DEBUG)
-        if (pDebugPrint)
+        pQueue = queueFor(priority);
+    }
+
+    if (pQueue == &priorityTransmitQueue)
+    {
+        if (pQueue->space() < sizeof(startMicros) + frameLength)
         {
-            pDebugPrint->print("checksum mismatch: expected ");
-            pDebugPrint->print(expected, HEX);
-            pDebugPrint->print(" but got ");
-            pDebugPrint->println(actual, HEX);
+            return rejectCommand(frameLength);
         }
+        // remember when it was sent, for the latency measurement
+        pQueue->push((const byte *) &startMicros, sizeof(startMicros));
+    }
+    else if (pQueue && (pQueue->space() < frameLength))
+    {
+        return rejectCommand(frameLength);
+    }
+
+    return true;
+}
+
+iPodSerial::TransmitQueue *iPodSerial::queueFor(CommandPriority priority)
+{
+    // if there's only one queue, everything shares it
+    TransmitQueue *pPreferred = (priority == PRIORITY_INTERACTIVE) ? &priorityTransmitQueue : &transmitQueue;
+    TransmitQueue *pOther = (priority == PRIORITY_INTERACTIVE) ? &transmitQueue : &priorityTransmitQueue;
+
+    if (pPreferred->isEnabled())
+    {
+        return pPreferred;
+    }
+    return pOther->isEnabled() ? pOther : 0;
+}
+
+bool iPodSerial::rejectCommand(size_t frameLength)
+{
+#if IPOD_SERIAL_LOG_LEVEL >= IPOD_SERIAL_LOG_ERROR
+    debugNumber(PSTR("Transmit queue full, dropping command of length: "), frameLength);
+#else
+    (void) frameLength;
 #endif
+    return false;
+}
 
-        return false;
+size_t iPodSerial::writeHeaderAndLength(byte *p, size_t length) // length is mode+command+parameters in bytes
+{
+    size_t i = 0;
+    p[i++] = AAPFrameParser::HEADER1;
+    p[i++] = AAPFrameParser::HEADER2;
+
+    if (length > 0xFF)
+    {
+        // large packet form: marker then 2-byte big-endian length
+        p[i++] = AAPFrameParser::LARGE_PACKET_MARKER;
+        p[i++] = (length & 0xFF00) >> 8;
+        p[i++] = (length & 0x00FF) >> 0;
+    }
+    else
+    {
+        p[i++] = length;
     }
+
+    return i;
 }
 
-#if defined(IPOD_SERIAL_DEBUG)
-void iPodSerial::dumpReceive()
+byte iPodSerial::calculateChecksum(
+    const byte *pLength,
+    size_t lengthBytes,
+    size_t length,
+    const byte *pData)
 {
-    if (!pDebugPrint)
+    // the checksum covers the length bytes and the data, but not the header
+    byte sum = 0;
+    for (size_t i = 0; i < lengthBytes; ++i)
     {
-        return;
+        sum += pLength[i];
     }
+    for (size_t i = 0; i < length; ++i)
+    {
+        sum += pData[i];
+    }
+    return (0x100 - sum) & 0xFF;
+}
 
-    pDebugPrint->print("data size = ");
-    pDebugPrint->println(dataSize, DEC);
+void iPodSerial::writeNumber(byte *p, unsigned long n)
+{
+    AAPParameter<unsigned long>::write(p, n);
+}
 
-    for (size_t i = 0; i < sizeof(dataBuffer); ++i)
+void iPodSerial::sendBytes(size_t length, const byte *pData, TransmitQueue *pQueue)
+{
+    if (pQueue)
     {
-        pDebugPrint->print("dataBuffer[");
-        pDebugPrint->print(i, DEC);
-        pDebugPrint->print("] = ");
-        pDebugPrint->println(dataBuffer[i], HEX);
+        pQueue->push(pData, length);
     }
+    else
+    {
+        pSerial->write(pData, length);
+        wireTrace.record(AAPWireTrace::RECORD_SENT, pData, length);
+    }
+
+#if IPOD_SERIAL_LOG_LEVEL >= IPOD_SERIAL_LOG_TRACE
+    debugBytes(pQueue ? PSTR("queued bytes") : PSTR("sent bytes"), pData, length);
+#endif
 }
+
+void iPodSerial::setTransmitQueue(byte *pBuffer, size_t size, CommandPriority priority)
+{
+    TransmitQueue &queue = (priority == PRIORITY_INTERACTIVE) ? priorityTransmitQueue : transmitQueue;
+    queue.setBuffer(pBuffer, size);
+
+    // The rest of a frame part way out of this queue has just gone with
+    // it, but one part way out of the other queue still has to be finished.
+    if (pActiveQueue == &queue)
+    {
+        pActiveQueue = 0;
+        activeFrameRemaining = 0;
+    }
+}
+
+size_t iPodSerial::getTransmitQueueDepth()
+{
+    return transmitQueue.depth() + priorityTransmitQueue.depth();
+}
+
+unsigned long iPodSerial::getLastInteractiveLatencyMicros()
+{
+    return lastInteractiveLatencyMicros;
+}
+
+unsigned long iPodSerial::getMaxInteractiveLatencyMicros()
+{
+    return maxInteractiveLatencyMicros;
+}
+
+void iPodSerial::recordInteractiveLatency(unsigned long latencyMicros)
+{
+    lastInteractiveLatencyMicros = latencyMicros;
+    if (latencyMicros > maxInteractiveLatencyMicros)
+    {
+        maxInteractiveLatencyMicros = latencyMicros;
+    }
+}
+
+int iPodSerial::writeRoom()
+{
+    // Returns how many bytes can be written to the port without blocking,
+    // or -1 if it can't say. A port that has never said it has room is
+    // taken to be one that can't (Print's own availableForWrite() always
+    // returns 0) rather than one that's full.
+#if IPOD_SERIAL_AVAILABLE_FOR_WRITE
+    const int room = pSerial->availableForWrite();
+    if (room > 0)
+    {
+        writeRoomSeen = true;
+        return room;
+    }
+    if (writeRoomSeen)
+    {
+        return 0;
+    }
 #endif
+    return -1;
+}
 
-void iPodSerial::processResponse()
+void iPodSerial::drainTransmitQueue()
 {
-    const int avail = pSerial->available();
-    if (avail <= 0)
+    // with no way to tell, write everything and let the port block
+    const int reported = writeRoom();
+    size_t room = (reported < 0) ? (size_t) -1 : (size_t) reported;
+
+    while (room > 0)
     {
-        return;
+        if (activeFrameRemaining == 0)
+        {
+            // Between frames, so this is where interactive commands get to
+            // jump the queue. Once a frame has been started it has to be
+            // finished before anything else can go, or we'd garble it.
+            if (priorityTransmitQueue.depth() > 0)
+            {
+                pActiveQueue = &priorityTransmitQueue;
+                pActiveQueue->pop((byte *) &activeFrameMicros, sizeof(activeFrameMicros));
+            }
+            else if (transmitQueue.depth() > 0)
+            {
+                pActiveQueue = &transmitQueue;
+            }
+            else
+            {
+                return;
+            }
+            activeFrameRemaining = queuedFrameLength(*pActiveQueue);
+        }
+
+        const size_t chunk = (room < activeFrameRemaining) ? room : activeFrameRemaining;
+        pActiveQueue->drainTo(*pSerial, chunk, wireTrace);
+        activeFrameRemaining -= chunk;
+        room -= chunk;
+
+        if ((activeFrameRemaining == 0) && (pActiveQueue == &priorityTransmitQueue))
+        {
+            recordInteractiveLatency(micros() - activeFrameMicros);
+        }
     }
+}
 
-    // read a single byte from the iPod
-    const int b = pSerial->read();
+size_t iPodSerial::queuedFrameLength(const TransmitQueue &queue, size_t offset)
+{
+    // header, length, data and checksum
+    const byte length = queue.peek(offset + 2);
+    if (length == AAPFrameParser::LARGE_PACKET_MARKER)
+    {
+        return 2 + 3 + ((((size_t) queue.peek(offset + 3)) << 8) | queue.peek(offset + 4)) + 1;
+    }
+    return 2 + 1 + length + 1;
+}
 
-#if defined(IPOD_SERIAL_DEBUG)
-    if (pDebugPrint)
+bool iPodSerial::isBackgroundCommandWaiting(byte mode, byte cmdByte1, byte cmdByte2)
+{
+    // skip the rest of a frame that's already on its way out
+    size_t offset = (pActiveQueue == &transmitQueue) ? activeFrameRemaining : 0;
+    while (offset < transmitQueue.depth())
+    {
+        const size_t data = offset + ((transmitQueue.peek(offset + 2) == AAPFrameParser::LARGE_PACKET_MARKER) ? 5 : 3);
+        if ((transmitQueue.peek(data) == mode) &&
+            (transmitQueue.peek(data + 1) == cmdByte1) &&
+            (transmitQueue.peek(data + 2) == cmdByte2))
+        {
+            return true;
+        }
+        offset += queuedFrameLength(transmitQueue, offset);
+    }
+    return false;
+}
+
+iPodSerial::TransmitQueue::TransmitQueue()
+    : pBuffer(0),
+      size(0),
+      head(0),
+      count(0)
+{
+}
+
+void iPodSerial::TransmitQueue::setBuffer(byte *pNewBuffer, size_t newSize)
+{
+    pBuffer = pNewBuffer;
+    size = pNewBuffer ? newSize : 0;
+    head = 0;
+    count = 0;
+}
+
+bool iPodSerial::TransmitQueue::isEnabled() const
+{
+    return size > 0;
+}
+
+size_t iPodSerial::TransmitQueue::depth() const
+{
+    return count;
+}
+
+size_t iPodSerial::TransmitQueue::space() const
+{
+    return size - count;
+}
+
+void iPodSerial::TransmitQueue::push(const byte *pData, size_t length)
+{
+    size_t tail = head + count;
+    if (tail >= size)
     {
-        pDebugPrint->print("Receive Status: ");
-        pDebugPrint->println(STATE_NAME[receiveState]);
+        tail -= size;
+    }
 
-        pDebugPrint->print(b, HEX);
-        pDebugPrint->print(" ");
+    // at most two copies: up to the end of the buffer, then from the start
+    const size_t firstPart = (length < size - tail) ? length : size - tail;
+    memcpy(&pBuffer[tail], pData, firstPart);
+    memcpy(pBuffer, pData + firstPart, length - firstPart);
+    count += length;
+}
 
-        if (isprint(b))
+byte iPodSerial::TransmitQueue::peek(size_t offset) const
+{
+    size_t index = head + offset;
+    if (index >= size)
+    {
+        index -= size;
+    }
+    return pBuffer[index];
+}
+
+void iPodSerial::TransmitQueue::pop(byte *pData, size_t length)
+{
+    for (size_t i = 0; i < length; ++i)
+    {
+        pData[i] = pBuffer[head];
+        if (++head == size)
         {
-#if defined(ARDUINO) && ARDUINO >= 100
-            pDebugPrint->write(b);
-#else
-            pDebugPrint->print(b, BYTE);
-#endif
+            head = 0;
         }
-        pDebugPrint->println();
     }
-#endif
+    count -= length;
+}
 
-    switch (receiveState)
+size_t iPodSerial::TransmitQueue::drainTo(Stream &stream, size_t maxBytes, AAPWireTrace &trace)
+{
+    size_t written = 0;
+    while ((count > 0) && (written < maxBytes))
     {
-    case WAITING_FOR_HEADER1:
-        if (b == HEADER1)
+        size_t chunk = size - head; // contiguous bytes before we wrap
+        if (chunk > count)
         {
-            receiveState = WAITING_FOR_HEADER2;
+            chunk = count;
+        }
+        if (chunk > maxBytes - written)
+        {
+            chunk = maxBytes - written;
         }
-        break;
 
-    case WAITING_FOR_HEADER2:
-        if (b == HEADER2)
+        stream.write(&pBuffer[head], chunk);
+        trace.record(AAPWireTrace::RECORD_SENT, &pBuffer[head], chunk);
+        head += chunk;
+        if (head == size)
         {
-            receiveState = WAITING_FOR_LENGTH;
+            head = 0;
         }
-        break;
+        count -= chunk;
+        written += chunk;
+    }
+    return written;
+}
 
-    case WAITING_FOR_LENGTH:
-        dataSize = b;
-        pData = dataBuffer;
-        receiveState = WAITING_FOR_DATA;
-#if defined(IPOD_SERIAL_DEBUG)
-        if (pDebugPrint)
+void iPodSerial::setReceiveBudget(unsigned int maxBytes, unsigned long maxMillis)
+{
+    receiveBudgetBytes = maxBytes;
+    receiveBudgetMillis = maxMillis;
+}
+
+byte iPodSerial::getLastLoopFrameCount()
+{
+    return lastLoopFrameCount;
+}
+
+unsigned long iPodSerial::getResyncCount()
+{
+    return parser.getResyncCount();
+}
+
+size_t iPodSerial::getLastResyncBytesLost()
+{
+    return parser.getLastResyncBytesLost();
+}
+
+unsigned long iPodSerial::getLastResyncMillis()
+{
+    return lastResyncMillis;
+}
+
+unsigned long iPodSerial::beginLoop()
+{
+    drainTransmitQueue();
+
+    lastLoopFrameCount = 0;
+
+    return receiveBudgetMillis ? millis() : 0;
+}
+
+bool iPodSerial::receiveByte(byte &in)
+{
+    const int waiting = pSerial->available();
+    if (waiting <= 0)
+    {
+        return false;
+    }
+
+#if IPOD_SERIAL_STATS
+    if (waiting > peakAvailable)
+    {
+        peakAvailable = waiting;
+    }
+#endif
+
+    // read a single byte from the iPod
+    in = (byte) pSerial->read();
+    wireTrace.record(AAPWireTrace::RECORD_RECEIVED, &in, 1);
+
+#if IPOD_SERIAL_LOG_LEVEL >= IPOD_SERIAL_LOG_TRACE
+    debugBytes(stateName(parser.getState()), &in, 1);
+#endif
+
+#if IPOD_SERIAL_STATS
+    ++bytesReceived;
+#endif
+    return true;
+}
+
+bool iPodSerial::isResyncing()
+{
+    return parser.isResyncing();
+}
+
+AAPFrameParser::Event iPodSerial::parseByte(byte in, bool wasResyncing, size_t &used)
+{
+#if IPOD_SERIAL_PROFILE
+    const unsigned long parseStartMicros = micros();
+#endif
+    used = parser.feed(&in, 1);
+#if IPOD_SERIAL_PROFILE
+    profileRecord(PROFILE_PARSE, parseStartMicros);
+#endif
+
+    const AAPFrameParser::Event event = parser.getEvent();
+    if ((event == AAPFrameParser::EVENT_FRAME) ||
+        (event == AAPFrameParser::EVENT_LAST_CHUNK) ||
+        (event == AAPFrameParser::EVENT_FRAME_SKIPPED))
+    {
+        if (wasResyncing)
+        {
+            lastResyncMillis = millis() - resyncStartMillis;
+        }
+        if (lastLoopFrameCount < 0xFF)
         {
-            pDebugPrint->print("Data length is ");
-            pDebugPrint->println(dataSize, DEC);
+            ++lastLoopFrameCount;
         }
+#if IPOD_SERIAL_STATS
+        ++framesReceived;
 #endif
+    }
+
+    switch (event)
+    {
+    case AAPFrameParser::EVENT_FRAME:
+    case AAPFrameParser::EVENT_FRAME_HEADER:
+        dataSize = parser.frameLength();
         break;
 
-    case WAITING_FOR_DATA:
-        *pData++ = b;
+    case AAPFrameParser::EVENT_FRAME_SKIPPED:
+        frameUnhandled();
+        break;
 
-        if ((pData - dataBuffer) == dataSize)
+    case AAPFrameParser::EVENT_CHUNK:
+    case AAPFrameParser::EVENT_LAST_CHUNK:
+        if (pLargeMessageHandler)
         {
-            receiveState = WAITING_FOR_CHECKSUM;
+            IPOD_SERIAL_PROFILED_HANDLER(pLargeMessageHandler(
+                parser.frameLength(),
+                parser.chunkOffset(),
+                parser.frameData(),
+                parser.chunkLength(),
+                (event == AAPFrameParser::EVENT_CHUNK) ? LARGE_MESSAGE_PARTIAL : LARGE_MESSAGE_COMPLETE));
         }
-#if defined(IPOD_SERIAL_DEBUG)
-        else
+        else if (event == AAPFrameParser::EVENT_LAST_CHUNK)
         {
-            if (pDebugPrint)
-            {
-                pDebugPrint->print("Waiting for ");
-                pDebugPrint->println(dataSize - (pData - dataBuffer));
-            }
+            frameUnhandled();
         }
-#endif
         break;
 
-    case WAITING_FOR_CHECKSUM:
-        if (validChecksum(b))
+    case AAPFrameParser::EVENT_STREAM_FAILED:
+        if (pLargeMessageHandler)
         {
-            processData();
+            IPOD_SERIAL_PROFILED_HANDLER(pLargeMessageHandler(parser.frameLength(), 0, 0, 0, LARGE_MESSAGE_FAILED));
         }
-        receiveState = WAITING_FOR_HEADER1;
-        memset(dataBuffer, 0, sizeof(dataBuffer));
+        break;
+
+    case AAPFrameParser::EVENT_NONE:
         break;
     }
+    return event;
 }
 
-void iPodSerial::sendCommandWithLength(
-    size_t length,
-    const byte *pData)
+void iPodSerial::skipFrame()
+{
+#if IPOD_SERIAL_LOG_LEVEL >= IPOD_SERIAL_LOG_INFO
+    debugBytes(PSTR("Skipping frame:"), dataBuffer, AAPFrameParser::HEADER_EVENT_SIZE);
+#endif
+    parser.skipFrame();
+}
+
+void iPodSerial::truncateFrame()
+{
+#if IPOD_SERIAL_LOG_LEVEL >= IPOD_SERIAL_LOG_INFO
+    debugBytes(PSTR("Frame too long, keeping what fits:"), dataBuffer, AAPFrameParser::HEADER_EVENT_SIZE);
+#endif
+    parser.truncateFrame();
+}
+
+void iPodSerial::byteParsed(bool wasResyncing)
+{
+    if (!wasResyncing && parser.isResyncing())
+    {
+        resyncStartMillis = millis();
+#if IPOD_SERIAL_LOG_LEVEL >= IPOD_SERIAL_LOG_ERROR
+        debug(PSTR("bad data from iPod, resyncing"));
+#endif
+    }
+}
+
+bool iPodSerial::receiveBudgetSpent(unsigned int bytesRead, unsigned long startMillis)
+{
+    if (receiveBudgetBytes && (bytesRead >= receiveBudgetBytes))
+    {
+        return true;
+    }
+
+    return receiveBudgetMillis && ((millis() - startMillis) >= receiveBudgetMillis);
+}
+
+void iPodSerial::endLoop()
 {
 #if defined(IPOD_SERIAL_DEBUG)
-    if (pDebugPrint)
+    // nothing's waiting, so now's a good time to print a debug message
+    if (pSerial->available() == 0)
     {
-        pDebugPrint->print("Sending command of length: ");
-        pDebugPrint->println(length, DEC);
+        debugLog.printOne(pDebugPrint, pLogPrint);
     }
 #endif
+}
 
-    sendHeader();
-    sendLength(length);
-    sendBytes(length, pData);
-    sendChecksum();
+void iPodSerial::processData()
+{
+#if IPOD_SERIAL_LOG_LEVEL >= IPOD_SERIAL_LOG_INFO
+    debug(PSTR("Ignoring data from iPod:"));
+    dumpReceive();
+#endif
+    frameUnhandled();
 }
 
-void iPodSerial::sendCommand(
-    byte mode,
-    byte cmdByte1,
-    byte cmdByte2)
+bool iPodSerial::wantsFrame()
 {
-    sendHeader();
-    sendLength(1 + 1 + 1);
-    sendByte(mode);
-    sendByte(cmdByte1);
-    sendByte(cmdByte2);
-    sendChecksum();
+    return true;
 }
 
-void iPodSerial::sendCommandWithOneByteParam(
-    byte mode,
-    byte cmdByte1,
-    byte cmdByte2,
-    byte byteParam)
+bool iPodSerial::wantsFrameTruncated()
 {
-    sendHeader();
-    sendLength(1 + 1 + 1 + 1);
-    sendByte(mode);
-    sendByte(cmdByte1);
-    sendByte(cmdByte2);
-    sendByte(byteParam);
-    sendChecksum();
+    return false;
 }
 
-void iPodSerial::sendCommandWithOneNumberParam(
-    byte mode,
-    byte cmdByte1,
-    byte cmdByte2,
-    unsigned long numberParam)
+bool iPodSerial::frameTruncated()
 {
-    sendHeader();
-    sendLength(1 + 1 + 1 + 4);
-    sendByte(mode);
-    sendByte(cmdByte1);
-    sendByte(cmdByte2);
-    sendNumber(numberParam);
-    sendChecksum();
+    return parser.frameTruncated();
 }
 
-void iPodSerial::sendCommandWithOneByteAndOneNumberParam(
-    byte mode,
-    byte cmdByte1,
-    byte cmdByte2,
-    byte byteParam1,
-    unsigned long numberParam2)
+void iPodSerial::frameUnhandled()
 {
-    sendHeader();
-    sendLength(1 + 1 + 1 + 1 + (1 * 4));
-    sendByte(mode);
-    sendByte(cmdByte1);
-    sendByte(cmdByte2);
-    sendByte(byteParam1);
-    sendNumber(numberParam2);
-    sendChecksum();
+#if IPOD_SERIAL_STATS
+    ++unhandledFrames;
+#endif
 }
 
-void iPodSerial::sendCommandWithOneByteAndTwoNumberParams(
-    byte mode,
-    byte cmdByte1,
-    byte cmdByte2,
-    byte byteParam1,
-    unsigned long numberParam2,
-    unsigned long numberParam3)
+void iPodSerial::setWireTrace(byte *pBuffer, size_t size)
 {
-    sendHeader();
-    sendLength(1 + 1 + 1 + 1 + (2 * 4));
-    sendByte(mode);
-    sendByte(cmdByte1);
-    sendByte(cmdByte2);
-    sendByte(byteParam1);
-    sendNumber(numberParam2);
-    sendNumber(numberParam3);
-    sendChecksum();
+    wireTrace.setBuffer(pBuffer, size);
 }
 
-void iPodSerial::sendHeader()
+size_t iPodSerial::dumpWireTrace(Print &out)
 {
-    sendByte(HEADER1);
-    sendByte(HEADER2);
+    return wireTrace.dump(out);
 }
 
-void iPodSerial::sendLength(size_t length) // length is mode+command+parameters in bytes
+void iPodSerial::clearWireTrace()
 {
-    sendByte(length);
-    checksum = length;
+    wireTrace.clear();
 }
 
-void iPodSerial::sendBytes(size_t length, const byte *pData)
+#if IPOD_SERIAL_STATS
+unsigned long iPodSerial::getFramesReceived()
 {
-    for (size_t i = 0; i < length; i++)
-    {
-        sendByte(pData[i]);
-    }
+    return framesReceived;
 }
 
-void iPodSerial::sendByte(byte b)
+unsigned long iPodSerial::getBytesReceived()
 {
-    pSerial->write(b);
-    checksum += b;
+    return bytesReceived;
+}
 
-#if defined(IPOD_SERIAL_DEBUG)
-    // likely to slow stuff down!
-    if (pDebugPrint)
-    {
-        pDebugPrint->print("sent byte ");
-        pDebugPrint->println(b, HEX);
-    }
-#endif
+unsigned long iPodSerial::getChecksumFailureCount()
+{
+    return parser.getChecksumFailureCount();
 }
 
-void iPodSerial::sendNumber(unsigned long n)
+unsigned long iPodSerial::getBytesDiscarded()
 {
-    // parameter (4-byte int sent big-endian)
-    sendByte((n & 0xFF000000) >> 24);
-    sendByte((n & 0x00FF0000) >> 16);
-    sendByte((n & 0x0000FF00) >> 8);
-    sendByte((n & 0x000000FF) >> 0);
+    return parser.getDiscardedByteCount();
 }
 
-void iPodSerial::sendChecksum()
+unsigned long iPodSerial::getOverLengthFrameCount()
 {
-    sendByte((0x100 - checksum) & 0xFF);
+    return parser.getOverLengthCount();
 }
 
-void iPodSerial::loop()
+unsigned long iPodSerial::getUnhandledFrameCount()
 {
-    if (pSerial->available() > 0)
+    return unhandledFrames;
+}
+
+unsigned long iPodSerial::getSkippedFrameCount()
+{
+    return parser.getSkippedCount();
+}
+
+int iPodSerial::getPeakAvailable()
+{
+    return peakAvailable;
+}
+
+void iPodSerial::resetLinkStats()
+{
+    framesReceived = 0;
+    bytesReceived = 0;
+    unhandledFrames = 0;
+    peakAvailable = 0;
+    parser.resetCounts();
+}
+#endif
+
+#if IPOD_SERIAL_PROFILE
+void iPodSerial::profileRecord(ProfileStage stage, unsigned long startMicros)
+{
+    const unsigned long elapsed = micros() - startMicros;
+    ProfileCounter &counter = profileCounters[stage];
+    ++counter.count;
+    counter.totalMicros += elapsed;
+    if (elapsed > counter.worstMicros)
     {
-        processResponse();
+        counter.worstMicros = elapsed;
     }
 }
 
-void iPodSerial::processData()
+unsigned long iPodSerial::getProfileCount(ProfileStage stage)
 {
-#if defined(IPOD_SERIAL_DEBUG)
-    if (pDebugPrint)
+    return profileCounters[stage].count;
+}
+
+unsigned long iPodSerial::getProfileAverageMicros(ProfileStage stage)
+{
+    const ProfileCounter &counter = profileCounters[stage];
+    return counter.count ? (counter.totalMicros / counter.count) : 0;
+}
+
+unsigned long iPodSerial::getProfileWorstMicros(ProfileStage stage)
+{
+    return profileCounters[stage].worstMicros;
+}
+
+void iPodSerial::printProfile(Print &out)
+{
+    static const char *const STAGE_NAME[PROFILE_STAGE_COUNT] =
     {
-        pDebugPrint->println("Ignoring data from iPod:");
-        dumpReceive();
+        "loop",
+        "receive",
+        "parse",
+        "dispatch",
+        "handler"
+    };
+
+    for (byte stage = 0; stage < PROFILE_STAGE_COUNT; ++stage)
+    {
+        out.print(STAGE_NAME[stage]);
+        out.print(": n=");
+        out.print(getProfileCount((ProfileStage) stage));
+        out.print(" avg=");
+        out.print(getProfileAverageMicros((ProfileStage) stage));
+        out.print(" worst=");
+        out.print(getProfileWorstMicros((ProfileStage) stage));
+        out.println(" us");
     }
-#endif
 }
 
+void iPodSerial::resetProfile()
+{
+    memset(profileCounters, 0, sizeof(profileCounters));
+}
+#endif
+
 #if defined(IPOD_SERIAL_DEBUG)
-void iPodSerial::log(const char *message)
+void iPodSerial::log(const char *pMessage)
 {
-    if (pLogPrint)
-    {
-        pLogPrint->println(message);
-    }
+    debugLog.add(AAPDebugLog::TO_LOG, pMessage);
+}
+
+void iPodSerial::logBytes(const char *pMessage, const byte *pData, size_t length)
+{
+    debugLog.addBytes(AAPDebugLog::TO_LOG, pMessage, pData, length);
+}
+
+void iPodSerial::debug(const char *pMessage)
+{
+    debugLog.add(AAPDebugLog::TO_DEBUG, pMessage);
+}
+
+void iPodSerial::debugNumber(const char *pMessage, unsigned long number)
+{
+    debugLog.addNumber(AAPDebugLog::TO_DEBUG, pMessage, number);
+}
+
+void iPodSerial::debugBytes(const char *pMessage, const byte *pData, size_t length)
+{
+    debugLog.addBytes(AAPDebugLog::TO_DEBUG, pMessage, pData, length);
 }
 #endif
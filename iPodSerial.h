@@ -31,6 +31,11 @@
 #include "WProgram.h"
 #endif
 
+#include "AAPCommand.h"
+#include "AAPDebugLog.h"
+#include "AAPFrameParser.h"
+#include "AAPWireTrace.h"
+
 /**
  * Helper macro for figuring out the length of command byte arrays.
  */
@@ -40,23 +45,161 @@
 // setLogPrint and setDebugPrint
 //#define IPOD_SERIAL_DEBUG
 
+// With IPOD_SERIAL_DEBUG on, how much gets logged: IPOD_SERIAL_LOG_ERROR
+// for things going wrong, IPOD_SERIAL_LOG_INFO for commands and responses
+// as well, or IPOD_SERIAL_LOG_TRACE for every byte too. Messages wait in a
+// buffer of IPOD_SERIAL_LOG_BUFFER_SIZE bytes until loop() finds nothing
+// coming in from the iPod, and only then are printed, so that logging
+// doesn't change the timing much; messages that don't fit are dropped
+// (and counted), so make the buffer bigger if you see that happening.
+#define IPOD_SERIAL_LOG_ERROR 1
+#define IPOD_SERIAL_LOG_INFO 2
+#define IPOD_SERIAL_LOG_TRACE 3
+
+#if !defined(IPOD_SERIAL_DEBUG)
+#undef IPOD_SERIAL_LOG_LEVEL
+#define IPOD_SERIAL_LOG_LEVEL 0
+#elif !defined(IPOD_SERIAL_LOG_LEVEL)
+#define IPOD_SERIAL_LOG_LEVEL IPOD_SERIAL_LOG_INFO
+#endif
+
+#if !defined(IPOD_SERIAL_LOG_BUFFER_SIZE)
+#define IPOD_SERIAL_LOG_BUFFER_SIZE 128
+#endif
+
+// The longest message (mode, command and parameters) that the library will
+// receive from the iPod. Each library object needs this many bytes of RAM,
+// plus one, for its receive buffer; longer messages are skipped, except
+// that string handlers given the length (see AdvancedRemote.h) get them
+// cut short. The iPod can send up to 255, but most responses are much
+// shorter, so you can save RAM by lowering this if, say, you don't need
+// long track names. It has to
+// be at least 12 (the longest fixed-size response). Change it here, or with
+// a -D build flag if your build system lets you.
+#if !defined(IPOD_SERIAL_MAX_DATA_SIZE)
+#define IPOD_SERIAL_MAX_DATA_SIZE 128
+#endif
+
+#if (IPOD_SERIAL_MAX_DATA_SIZE < 12) || (IPOD_SERIAL_MAX_DATA_SIZE > 255)
+#error "IPOD_SERIAL_MAX_DATA_SIZE must be between 12 and 255"
+#endif
+
+// Link statistics (see getFramesReceived() and friends) cost 30 bytes of
+// RAM and a little time per byte received. Define this as 0 to leave them
+// out altogether.
+#if !defined(IPOD_SERIAL_STATS)
+#define IPOD_SERIAL_STATS 1
+#endif
+
+// Profiling (see getProfileWorstMicros() and friends) times loop(), the
+// handling of each byte and frame received, and the handlers called for
+// them, using micros(). It costs 60 bytes of RAM and a few calls to
+// micros() per byte, so it's left out unless you define this as 1.
+#if !defined(IPOD_SERIAL_PROFILE)
+#define IPOD_SERIAL_PROFILE 0
+#endif
+
+// Whether the core's serial ports have availableForWrite(), which the
+// transmit queues (see setTransmitQueue()) need in order to send without
+// blocking. Cores from before Arduino 1.0 don't; there, commands are
+// always written straight to the port, queues or not.
+#if !defined(IPOD_SERIAL_AVAILABLE_FOR_WRITE)
+#if defined(ARDUINO) && ARDUINO >= 100
+#define IPOD_SERIAL_AVAILABLE_FOR_WRITE 1
+#else
+#define IPOD_SERIAL_AVAILABLE_FOR_WRITE 0
+#endif
+#endif
+
+// Makes a call to a sketch's handler, timing it if profiling is on.
+#if IPOD_SERIAL_PROFILE
+#define IPOD_SERIAL_PROFILED_HANDLER(call) \
+    do \
+    { \
+        const unsigned long profileStartMicros = micros(); \
+        call; \
+        profileRecord(PROFILE_HANDLER, profileStartMicros); \
+    } while (0)
+#else
+#define IPOD_SERIAL_PROFILED_HANDLER(call) call
+#endif
+
+/**
+ * Everything about talking to the iPod that doesn't depend on what kind of
+ * remote you are: framing, sending and queueing commands, parsing what
+ * comes back, and statistics. Remotes are built on iPodSerialT (below)
+ * rather than on this directly.
+ */
 class iPodSerial
 {
+public: // enums
+    enum LargeMessageStatus
+    {
+        LARGE_MESSAGE_PARTIAL = 0,
+        LARGE_MESSAGE_COMPLETE,
+        LARGE_MESSAGE_FAILED
+    };
+
+    enum CommandPriority
+    {
+        PRIORITY_BACKGROUND = 0,
+        PRIORITY_INTERACTIVE
+    };
+
+    /**
+     * The things that are timed when IPOD_SERIAL_PROFILE is on. Each one
+     * includes the ones after it that it calls, e.g. a byte received
+     * includes the frame it completes, and the frame includes its handler.
+     */
+    enum ProfileStage
+    {
+        PROFILE_LOOP = 0,    // a call to loop()
+        PROFILE_RECEIVE,     // a byte received: parsing it plus anything below
+        PROFILE_PARSE,       // just the parsing of a byte
+        PROFILE_DISPATCH,    // a complete frame being handled, handlers included
+        PROFILE_HANDLER,     // a call to one of the sketch's handlers
+        PROFILE_STAGE_COUNT
+    };
+
+public: // handler definitions
+    typedef void LargeMessageHandler_t(size_t messageLength,
+                                       size_t offset,
+                                       const byte *pChunk,
+                                       size_t chunkLength,
+                                       LargeMessageStatus status);
+
 public: // attributes
     static const int IPOD_SERIAL_RATE = 19200;
+    static const size_t MAX_DATA_SIZE = IPOD_SERIAL_MAX_DATA_SIZE;
 
 public:
-    iPodSerial();
+    /**
+     * Limits how much received data a single call to loop() will process.
+     * By default loop() processes every byte that is waiting in the serial
+     * port's receive buffer before returning, so that bursts of responses
+     * (e.g. from getItemNames) don't overflow the receive buffer while the
+     * rest of the sketch is busy. If your sketch has other time-critical work
+     * to do you can cap the number of bytes read per call (maxBytes) and/or
+     * the time spent reading (maxMillis); pass 0 for no limit.
+     */
+    void setReceiveBudget(unsigned int maxBytes, unsigned long maxMillis);
 
     /**
-     * Checks for data coming in from the iPod and processes it if there is any.
-     * The library handles partial messages coming in from the iPod so it
-     * will buffer those chunks until it gets a complete message. Once a complete
-     * message (that the library understands) has been received it will process
-     * that message in here and call any callbacks that are applicable to that
-     * message and that have been configured.
+     * Returns the number of complete messages that were received and
+     * processed during the most recent call to loop().
+     */
+    byte getLastLoopFrameCount();
+
+    /**
+     * Link quality. When data from the iPod gets corrupted (e.g. by noise on
+     * the wiring) the library throws away what it can't use and rescans what
+     * it has for the start of the next good message. These report how many
+     * times that has happened, and how many bytes and milliseconds it took to
+     * recover the last time.
      */
-    void loop();
+    unsigned long getResyncCount();
+    size_t getLastResyncBytesLost();
+    unsigned long getLastResyncMillis();
 
     /**
      * Sets the serial port that the library will use to communicate with the iPod.
@@ -64,6 +207,123 @@ public:
      */
     void setSerial(Stream &newiPodSerial);
 
+    /**
+     * Messages from the iPod that are too long for the receive buffer (see
+     * IPOD_SERIAL_MAX_DATA_SIZE), such as large-packet messages carrying
+     * image data, are normally skipped. If you register a handler here they
+     * are passed to it instead, a buffer-full at a time as they arrive, so
+     * you don't need a buffer as big as the whole message. Every chunk but
+     * the last comes with LARGE_MESSAGE_PARTIAL; the last one comes with
+     * LARGE_MESSAGE_COMPLETE once the message's checksum has been checked.
+     * If the checksum is bad you get a LARGE_MESSAGE_FAILED call with no data
+     * instead, and should throw away what you've been given for that message.
+     */
+    void setLargeMessageHandler(LargeMessageHandler_t newHandler);
+
+    /**
+     * Gives the library somewhere to queue outgoing commands, so that sending
+     * one never has to wait for the serial port's own transmit buffer to
+     * empty. Queued bytes are passed to the serial port by loop() as it has
+     * room for them, so make sure you call loop() often. A command that
+     * won't fit in the queue is dropped (the send method returns false)
+     * rather than being partly sent.
+     *
+     * Without a queue, which is the default, commands go straight to the
+     * serial port and can stall your sketch while they are written.
+     * The serial port needs to support availableForWrite() for this to
+     * work; the hardware serial ports do. On a port that never says it
+     * has room (SoftwareSerial, for one, always says 0) commands are
+     * written straight to it as if there were no queue.
+     *
+     * There can be a queue for each priority. Interactive commands (button
+     * presses, playback control and so on) are sent ahead of any background
+     * commands (fetching track names and the like) that are still waiting,
+     * as soon as the frame currently going out is finished, unless they
+     * depend on one of those (AdvancedRemote's executeSwitch() waits for
+     * the switchToItem() before it, for example). If you only set up one
+     * queue, everything shares it in the order it was sent.
+     *
+     * Setting a queue again throws away whatever was waiting in it, even
+     * the rest of a frame that had started going out, which the iPod will
+     * then see as a bad frame.
+     */
+    void setTransmitQueue(byte *pBuffer,
+                          size_t size,
+                          CommandPriority priority = PRIORITY_BACKGROUND);
+
+    /**
+     * Returns the number of bytes waiting in the transmit queues.
+     */
+    size_t getTransmitQueueDepth();
+
+    /**
+     * How long, in microseconds, interactive commands have taken from
+     * being sent to being handed to the serial port: for the most recent
+     * one, and the longest so far. Only commands written straight away or
+     * sent from the interactive queue are timed.
+     */
+    unsigned long getLastInteractiveLatencyMicros();
+    unsigned long getMaxInteractiveLatencyMicros();
+
+    /**
+     * Turns on tracing of every byte sent to and received from the iPod,
+     * with timestamps, into a ring buffer that keeps the most recent
+     * size / AAPWireTrace::RECORD_SIZE bytes' worth. Pass 0 to turn it off.
+     * dumpWireTrace() writes the trace out in the binary form described in
+     * AAPWireTrace.h, for extras/host/trace_replay to play back.
+     */
+    void setWireTrace(byte *pBuffer, size_t size);
+    size_t dumpWireTrace(Print &out);
+    void clearWireTrace();
+
+#if IPOD_SERIAL_STATS
+    /**
+     * Link statistics, counted since the start or the last call to
+     * resetLinkStats(), to help with tuning things like how often loop()
+     * is called and the baud rate:
+     *   - good frames received, and bytes received in total
+     *   - frames that failed their checksum
+     *   - bytes thrown away while hunting for the start of a frame
+     *   - frames too long for the receive buffer (see IPOD_SERIAL_MAX_DATA_SIZE)
+     *   - frames nothing was interested in, e.g. because no handler was set,
+     *     and how many of those were skipped as soon as their mode and
+     *     command bytes arrived (see wantsFrame())
+     *   - the most bytes ever found waiting in the serial port's receive
+     *     buffer; if this reaches the buffer's size, bytes have probably
+     *     been lost
+     * Resetting them also resets getResyncCount().
+     */
+    unsigned long getFramesReceived();
+    unsigned long getBytesReceived();
+    unsigned long getChecksumFailureCount();
+    unsigned long getBytesDiscarded();
+    unsigned long getOverLengthFrameCount();
+    unsigned long getUnhandledFrameCount();
+    unsigned long getSkippedFrameCount();
+    int getPeakAvailable();
+    void resetLinkStats();
+#endif
+
+#if IPOD_SERIAL_PROFILE
+    /**
+     * How many times each ProfileStage has happened, and the average and
+     * longest time it took, in microseconds, since the start or the last
+     * call to resetProfile(). Times are only as fine-grained as micros()
+     * (4us on a 16MHz board) and include the profiling's own overhead, so
+     * averages of very quick stages are rough.
+     */
+    unsigned long getProfileCount(ProfileStage stage);
+    unsigned long getProfileAverageMicros(ProfileStage stage);
+    unsigned long getProfileWorstMicros(ProfileStage stage);
+
+    /**
+     * Prints a line for each ProfileStage with its count, average and worst.
+     */
+    void printProfile(Print &out);
+
+    void resetProfile();
+#endif
+
 #if defined(IPOD_SERIAL_DEBUG)
     /**
      * Sets the Print object to which debug messages will be directed.
@@ -76,6 +336,12 @@ public:
      * By default there isn't one and so log messages are off.
      */
     void setLogPrint(Print &newLogSerial);
+
+    /**
+     * Prints every message still waiting, rather than leaving loop() to
+     * get round to them.
+     */
+    void flushDebugLog();
 #endif
 
 protected: // attributes
@@ -83,87 +349,315 @@ protected: // attributes
     static const byte SIMPLE_REMOTE_MODE = 0x02;
     static const byte ADVANCED_REMOTE_MODE = 0x04;
 
-    byte dataSize;
-    byte dataBuffer[128]; // TODO: Why did I pick 128?
+    size_t dataSize;
+    byte dataBuffer[MAX_DATA_SIZE + 1]; // +1 for the terminating NUL
 #if defined(IPOD_SERIAL_DEBUG)
     Print *pDebugPrint;
     Print *pLogPrint;
+    byte debugLogBuffer[IPOD_SERIAL_LOG_BUFFER_SIZE];
+    AAPDebugLog debugLog;
 #endif
 
 protected: // methods
+    iPodSerial();
+
+    /*
+     * The pieces of loop() that don't depend on the remote (see
+     * iPodSerialT::loop()). parseByte() feeds a byte to the parser and
+     * returns what that led to: EVENT_FRAME if it completed a frame, which
+     * is then in dataBuffer for processData(), or EVENT_FRAME_HEADER if the
+     * mode and command bytes of a longer one are in dataBuffer, for
+     * wantsFrame() to look at (dataSize is the length the frame will be).
+     * used is set to 0 if the parser wants the same byte again.
+     */
+    unsigned long beginLoop();
+    bool receiveByte(byte &in);
+    bool isResyncing();
+    AAPFrameParser::Event parseByte(byte in, bool wasResyncing, size_t &used);
+    void skipFrame();
+    void truncateFrame();
+    void byteParsed(bool wasResyncing);
+    bool receiveBudgetSpent(unsigned int bytesRead, unsigned long startMillis);
+    void endLoop();
+
+    /**
+     * Handles a frame that's been received. This one ignores it; remotes
+     * that expect responses hide it with their own.
+     */
+    void processData();
+
+    /**
+     * Says whether the frame whose mode and command bytes have just
+     * arrived is worth keeping. If not, the rest of it goes by without
+     * being stored or dispatched, and it's counted as unhandled. This one
+     * keeps everything; remotes hide it with their own that only keep
+     * what their processData() would do something with.
+     */
+    bool wantsFrame();
+
+    /**
+     * Says whether a wanted frame that's too long for dataBuffer should be
+     * kept as far as it fits, rather than skipped (or streamed to the
+     * large-message handler). It then reaches processData() with
+     * frameTruncated() true. This one never does; remotes whose handlers
+     * can be told a string was cut short hide it with their own.
+     */
+    bool wantsFrameTruncated();
+    bool frameTruncated();
+
 #if defined(IPOD_SERIAL_DEBUG)
     /**
-     * convenience function to print out a debug message
+     * Queue up messages for the log or debug Print. The messages have to be
+     * PSTR() strings; debugNumber() and debugBytes() print the number or
+     * bytes after them.
      */
-    void log(const char *);
+    void log(const char *pMessage);
+    void logBytes(const char *pMessage, const byte *pData, size_t length);
+    void debug(const char *pMessage);
+    void debugNumber(const char *pMessage, unsigned long number);
+    void debugBytes(const char *pMessage, const byte *pData, size_t length);
 
     void dumpReceive();
 #endif
 
+    /**
+     * Writes a 4-byte number big-endian, the way the iPod wants it.
+     */
+    static void writeNumber(byte *p, unsigned long n);
+
+    /**
+     * Subclasses call this for frames they received but had no use for,
+     * so that they're counted in the link statistics.
+     */
+    void frameUnhandled();
+
+#if IPOD_SERIAL_PROFILE
+    /**
+     * Adds the time since startMicros to the given stage's profile.
+     */
+    void profileRecord(ProfileStage stage, unsigned long startMicros);
+#endif
+
     /*
-     * Different flavours of command-sending method to keep
-     * it simple for the other classes. They're a bit silly,
-     * and you wouldn't want many more than there are, but they
-     * suffice for the simple and advanced remotes.
+     * Sends a command, returning false if the transmit queue had no room
+     * for it. Remotes can hide sendCommandWithLength() with their own to
+     * pick the priority each command is sent with (by default they're all
+     * interactive); iPodSerialT::sendCommand() calls whichever
+     * one the remote has.
      */
-    void sendCommandWithLength(size_t length, const byte *pData);
-    void sendCommand(
-        byte mode,
-        byte cmdByte1,
-        byte cmdByte2);
-    void sendCommandWithOneByteParam(
-        byte mode,
-        byte cmdByte1,
-        byte cmdByte2,
-        byte param);
-    void sendCommandWithOneNumberParam(
-        byte mode,
-        byte cmdByte1,
-        byte cmdByte2,
-        unsigned long param);
-    void sendCommandWithOneByteAndOneNumberParam(
-        byte mode,
-        byte cmdByte1,
-        byte cmdByte2,
-        byte param1,
-        unsigned long param2);
-    void sendCommandWithOneByteAndTwoNumberParams(
-        byte mode,
-        byte cmdByte1,
-        byte cmdByte2,
-        byte param1,
-        unsigned long param2,
-        unsigned long param3);
+    bool sendCommandWithLength(size_t length, const byte *pData);
+    bool sendFrame(size_t length, const byte *pData, CommandPriority priority);
+
+    /**
+     * Sends a frame that's already complete, header to checksum, and kept
+     * in flash (PROGMEM), so there's nothing to work out before it goes.
+     * It mustn't be longer than a frame sendFrame() would put together.
+     */
+    bool sendFrameFromFlash(size_t frameLength, const byte *pFrame, CommandPriority priority);
+
+    /**
+     * Says whether a command with this mode and these command bytes is
+     * still waiting in the background queue, so that remotes can keep a
+     * command that depends on it from being sent ahead of it.
+     */
+    bool isBackgroundCommandWaiting(byte mode, byte cmdByte1, byte cmdByte2);
 
 private: // attributes
-    static const byte HEADER1 = 0xFF;
-    static const byte HEADER2 = 0x55;
+    // commands up to this long are assembled on the stack and
+    // handed to the serial port in a single write
+    static const size_t MAX_ASSEMBLED_DATA_SIZE = 16;
 
-    enum ReceiveState
+    AAPFrameParser parser;
+    AAPWireTrace wireTrace;
+
+    /*
+     * Ring buffer of bytes waiting to be written to the serial port.
+     */
+    class TransmitQueue
     {
-        WAITING_FOR_HEADER1 = 0,
-        WAITING_FOR_HEADER2,
-        WAITING_FOR_LENGTH,
-        WAITING_FOR_DATA,
-        WAITING_FOR_CHECKSUM
+    public:
+        TransmitQueue();
+        void setBuffer(byte *pBuffer, size_t size);
+        bool isEnabled() const;
+        size_t depth() const;
+        size_t space() const;
+        void push(const byte *pData, size_t length);
+        byte peek(size_t offset) const;
+        void pop(byte *pData, size_t length);
+        size_t drainTo(Stream &stream, size_t maxBytes, AAPWireTrace &trace);
+
+    private:
+        byte *pBuffer;
+        size_t size;
+        size_t head;
+        size_t count;
     };
-    ReceiveState receiveState;
-    byte *pData;
-    byte checksum;
+    TransmitQueue transmitQueue;
+    TransmitQueue priorityTransmitQueue;
 
     Stream *pSerial;
+    // set once the port has said it has room to write, which shows
+    // it supports availableForWrite()
+    bool writeRoomSeen;
+
+    unsigned int receiveBudgetBytes;
+    unsigned long receiveBudgetMillis;
+    byte lastLoopFrameCount;
+    unsigned long resyncStartMillis;
+    unsigned long lastResyncMillis;
+
+    LargeMessageHandler_t *pLargeMessageHandler;
+
+    // the queue whose frame is part-way out of the door
+    TransmitQueue *pActiveQueue;
+    size_t activeFrameRemaining;
+    unsigned long activeFrameMicros;
+
+    unsigned long lastInteractiveLatencyMicros;
+    unsigned long maxInteractiveLatencyMicros;
+
+#if IPOD_SERIAL_STATS
+    unsigned long framesReceived;
+    unsigned long bytesReceived;
+    unsigned long unhandledFrames;
+    int peakAvailable;
+#endif
+
+#if IPOD_SERIAL_PROFILE
+    struct ProfileCounter
+    {
+        unsigned long count;
+        unsigned long totalMicros;
+        unsigned long worstMicros;
+    };
+
+    ProfileCounter profileCounters[PROFILE_STAGE_COUNT];
+#endif
 
 private: // methods
-    void sendHeader();
-    void sendLength(size_t length);
-    void sendBytes(size_t length, const byte *pData);
-    void sendByte(byte b);
-    void sendNumber(unsigned long n);
-    void sendChecksum();
-    bool validChecksum(const byte actual);
-    void processResponse();
-
-    virtual void processData();
+    static size_t writeHeaderAndLength(byte *p, size_t length);
+    static byte calculateChecksum(const byte *pLength,
+                                  size_t lengthBytes,
+                                  size_t length,
+                                  const byte *pData);
+    void sendBytes(size_t length, const byte *pData, TransmitQueue *pQueue);
+    TransmitQueue *queueFor(CommandPriority priority);
+    bool chooseQueue(size_t frameLength, CommandPriority priority, unsigned long startMicros, TransmitQueue *&pQueue);
+    int writeRoom();
+    void drainTransmitQueue();
+    static size_t queuedFrameLength(const TransmitQueue &queue, size_t offset = 0);
+    void recordInteractiveLatency(unsigned long latencyMicros);
+    bool rejectCommand(size_t frameLength);
+};
+
+/**
+ * The front end that remotes derive from, passing themselves as Derived
+ * (e.g. class SimpleRemote : public iPodSerialT<SimpleRemote>). Frames
+ * received go straight to Derived::processData() and commands to
+ * Derived::sendCommandWithLength(), so which ones get called is decided
+ * when the sketch is compiled, with no virtual functions involved: that
+ * saves a vtable pointer in every remote, and lets the compiler inline
+ * the remote's handling of each frame into loop().
+ */
+template <class Derived>
+class iPodSerialT : public iPodSerial
+{
+public:
+    /**
+     * Checks for data coming in from the iPod and processes it if there is any.
+     * The library handles partial messages coming in from the iPod so it
+     * will buffer those chunks until it gets a complete message. Once a complete
+     * message (that the library understands) has been received it will process
+     * that message in here and call any callbacks that are applicable to that
+     * message and that have been configured.
+     */
+    void loop()
+    {
+#if IPOD_SERIAL_PROFILE
+        const unsigned long loopStartMicros = micros();
+#endif
+        const unsigned long startMillis = beginLoop();
+        unsigned int bytesRead = 0;
+
+        // drain everything that's waiting, unless the sketch has asked us to
+        // hand control back sooner than that
+        byte in;
+        while (receiveByte(in))
+        {
+#if IPOD_SERIAL_PROFILE
+            const unsigned long receiveStartMicros = micros();
+#endif
+            const bool wasResyncing = isResyncing();
+            size_t used;
+            do
+            {
+                // a bad frame can give up more than one good one when
+                // it's rescanned, so keep going until our byte is used
+                const AAPFrameParser::Event event = parseByte(in, wasResyncing, used);
+                if (event == AAPFrameParser::EVENT_FRAME)
+                {
+#if IPOD_SERIAL_PROFILE
+                    const unsigned long dispatchStartMicros = micros();
+#endif
+                    derived().processData();
+#if IPOD_SERIAL_PROFILE
+                    profileRecord(PROFILE_DISPATCH, dispatchStartMicros);
+#endif
+                }
+                else if (event == AAPFrameParser::EVENT_FRAME_HEADER)
+                {
+                    if (!derived().wantsFrame())
+                    {
+                        skipFrame();
+                    }
+                    else if ((dataSize > IPOD_SERIAL_MAX_DATA_SIZE) && derived().wantsFrameTruncated())
+                    {
+                        truncateFrame();
+                    }
+                }
+            } while (used == 0);
+            byteParsed(wasResyncing);
+#if IPOD_SERIAL_PROFILE
+            profileRecord(PROFILE_RECEIVE, receiveStartMicros);
+#endif
+
+            if (receiveBudgetSpent(++bytesRead, startMillis))
+            {
+                break;
+            }
+        }
+
+        endLoop();
+#if IPOD_SERIAL_PROFILE
+        profileRecord(PROFILE_LOOP, loopStartMicros);
+#endif
+    }
+
+protected: // methods
+    /**
+     * Sends a command: the mode, the two command bytes and then any
+     * parameters, each a byte or a 4-byte number (see AAPCommand.h). The
+     * length and layout of the frame are fixed when the sketch is
+     * compiled, so a command of any shape costs no more than the
+     * hand-written one it replaces.
+     */
+    template <typename... Params>
+    bool sendCommand(
+        byte mode,
+        byte cmdByte1,
+        byte cmdByte2,
+        Params... params)
+    {
+        byte data[1 + 1 + 1 + AAPParametersSize<Params...>::SIZE] = {mode, cmdByte1, cmdByte2};
+        writeAAPParameters(&data[3], params...);
+        return derived().sendCommandWithLength(ARRAY_LEN(data), data);
+    }
+
+private: // methods
+    Derived &derived()
+    {
+        return static_cast<Derived &>(*this);
+    }
 };
 
 #endif // IPOD_SERIAL